@@ -9,10 +9,23 @@
    Windows EXE file, and then be run as a standalone program.
    We may use this technique for the Windows version of the Icon language processor.
    Mark Riordan   2025-03-16
+
+   CHECKPOINT ["file"] saves the state of a running program (variables,
+   FOR loops, GOSUB stack, the program itself) to file, or basic.ckp.
+   basic -r file restores it and runs on from the line after the
+   CHECKPOINT.
  */
 #include <stdio.h>
 #include <string.h>
 
+#include "../peoverlay/peoverlay.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #define O(b,f,u,s,c,a)b(){int o=f();switch(*p++){X u:_ o s b();X c:_ o a b();default:p--;_ o;}}
 #define t(e,d,_,C)X e:f=fopen(B+d,_);C;fclose(f)
 #define U(y,z)while(p=Q(s,y))*p++=z,*p=' '
@@ -40,7 +53,7 @@ A Q(s, o) A s, o;
 
 G() {
     l = atoi(B);
-    m[l] && free(m[l]);
+    m[l] && (free(m[l]), 0);
     (p = Q(B, " ")) ? strcpy(m[l] = malloc(strlen(p)), p + 1) : (m[l] = 0, 0);
 }
 O(S, J, '=', ==, '#', !=)
@@ -54,12 +67,176 @@ O(J, K, '<', <, '>', >) O(K, V, '$', <=, '!', >=)
         o = S(), p++, o : P[*p++];
 }
 
+A * cmds;   /* commands to run before asking the user for any */
+int warm;   /* nonzero if RUN is to continue from a restored checkpoint */
+
+#define CKP_MAGIC "BASCKP1"
+#define CKP_DEFAULT "basic.ckp"
+
+/* A checkpoint file is this header; the variables P, the FOR limits M
+ * and loop lines L; the GOSUB stack; and then each program line as its
+ * number, its length, and its text with a zero after it.  Everything is
+ * in native ints, so a checkpoint is for the same build of basic.
+ */
+typedef struct {
+    char magic[8];
+    int  line;      /* the line that made the checkpoint */
+    int  depth;     /* entries on the GOSUB stack */
+    int  nlines;    /* program lines that follow */
+} CkpHeader;
+
+/* CHECKPOINT ["file"]: save the state of the running program, so that
+ * basic -r file can carry on from the next line.
+ */
+void checkpoint() {
+    char *name = CKP_DEFAULT, *end;
+    CkpHeader h;
+    FILE *fp;
+    int k, len, ok;
+
+    if (B[10] == '"') {
+        name = B + 11;
+        if ((end = strchr(name, '"')) != NULL) *end = '\0';
+    }
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CKP_MAGIC, sizeof(h.magic));
+    h.line = l;
+    h.depth = (int)(C - E);
+    for (k = 0; k < 11 * R; k++) h.nlines += m[k] != 0;
+
+    fp = fopen(name, "wb");
+    if (!fp) {
+        fprintf(stderr, "CHECKPOINT: error creating %s\n", name);
+        return;
+    }
+    ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+        fwrite(P, sizeof(int), R, fp) == R &&
+        fwrite(M, sizeof(int), R, fp) == R &&
+        fwrite(L, sizeof(int), R, fp) == R &&
+        fwrite(E, sizeof(int), h.depth, fp) == (size_t)h.depth;
+    for (k = 0; ok && k < 11 * R; k++) {
+        if (!m[k]) continue;
+        len = (int)strlen(m[k]);
+        ok = fwrite(&k, sizeof(int), 1, fp) == 1 &&
+            fwrite(&len, sizeof(int), 1, fp) == 1 &&
+            fwrite(m[k], 1, len + 1, fp) == (size_t)len + 1;
+    }
+    if (fclose(fp) != 0 || !ok) {
+        fprintf(stderr, "CHECKPOINT: error writing %s\n", name);
+        remove(name);
+    }
+}
+
+/* Restore a checkpoint made by CHECKPOINT, replacing any program, and
+ * arrange for RUN to carry on from the line after the checkpoint.
+ * The file is mapped rather than read; the lines are copied out of it,
+ * since the interpreter changes and frees them.  Every count, length
+ * and line number in it is checked before it is used.
+ */
+void restore(char *name) {
+    const char *buf, *pos, *end;
+    CkpHeader h;
+    size_t size;
+    int k, n, len, ok;
+#ifdef _WIN32
+    FILE *fp = fopen(name, "rb");
+    char *mem = NULL;
+
+    size = 0;
+    if (fp && fseek(fp, 0, SEEK_END) == 0 && (long)(size = ftell(fp)) > 0 &&
+        (mem = malloc(size)) != NULL && fseek(fp, 0, SEEK_SET) == 0 &&
+        fread(mem, 1, size, fp) != size) {
+        free(mem);
+        mem = NULL;
+    }
+    if (fp) fclose(fp);
+    buf = mem;
+#else
+    struct stat st;
+    int fd = open(name, O_RDONLY);
+
+    buf = NULL;
+    size = 0;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        size = (size_t)st.st_size;
+        buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buf == MAP_FAILED) buf = NULL;
+    }
+    if (fd >= 0) close(fd);
+#endif
+    if (!buf) {
+        fprintf(stderr, "Error reading checkpoint %s\n", name);
+        exit(2);
+    }
+
+    pos = buf;
+    end = buf + size;
+    ok = size >= sizeof(h) + 3 * R * sizeof(int);
+    if (ok) {
+        memcpy(&h, pos, sizeof(h));
+        pos += sizeof(h);
+        ok = memcmp(h.magic, CKP_MAGIC, sizeof(h.magic)) == 0 &&
+            h.line >= 0 && h.line < 11 * R && h.depth >= 0 && h.depth <= R &&
+            h.nlines >= 0 && h.nlines <= 11 * R &&
+            (size_t)(end - pos) >= (3 * R + h.depth) * sizeof(int);
+    }
+    if (ok) {
+        memcpy(P, pos, R * sizeof(int));
+        memcpy(M, pos += R * sizeof(int), R * sizeof(int));
+        memcpy(L, pos += R * sizeof(int), R * sizeof(int));
+        memcpy(E, pos += R * sizeof(int), h.depth * sizeof(int));
+        pos += h.depth * sizeof(int);
+        /* RETURN and NEXT go back to these lines, so they must be lines */
+        for (k = 0; k < R; k++) {
+            ok = ok && L[k] >= 0 && L[k] < 11 * R &&
+                (k >= h.depth || (E[k] >= 0 && E[k] < 11 * R));
+        }
+    }
+    if (ok) N(free(m[i]), 0), m[i] = 0;
+    for (n = 0; ok && n < h.nlines; n++) {
+        ok = (size_t)(end - pos) >= 2 * sizeof(int);
+        if (!ok) break;
+        memcpy(&k, pos, sizeof(int));
+        memcpy(&len, pos + sizeof(int), sizeof(int));
+        pos += 2 * sizeof(int);
+        ok = k >= 0 && k < 11 * R && len >= 0 && len < end - pos && pos[len] == '\0' &&
+            (m[k] = malloc(len + 1)) != NULL;
+        if (ok) memcpy(m[k], pos, len + 1);
+        pos += ok ? len + 1 : 0;
+    }
+#ifdef _WIN32
+    free(mem);
+#else
+    munmap((void *)buf, size);
+#endif
+    if (!ok) {
+        fprintf(stderr, "Invalid checkpoint %s\n", name);
+        exit(2);
+    }
+
+    C = E + h.depth;
+    l = h.line + 1;
+    warm = 1;
+}
+
+/* Get the next command into B.
+ * Exit:  Returns B, or NULL at end of input.
+ */
+A getcmd() {
+  if (cmds && *cmds) return strcpy(B, *cmds++);
+  puts("Ok");
+  return gets(B);
+}
+
 int basic() {
   m[11 * R] = "E";
-  while (puts("Ok"), gets(B)) switch ( * B) {
-    X 'R': C = E;
-    l = 1;
-    for (i = 0; i < R; P[i++] = 0);
+  while (getcmd()) switch ( * B) {
+    X 'R': if (!warm) {
+      C = E;
+      l = 1;
+      for (i = 0; i < R; P[i++] = 0);
+    }
+    warm = 0;
     while (l) {
       while (!(s = m[l])) l++;
       if (!Q(s, "\"")) {
@@ -81,75 +258,62 @@ int basic() {
         P[i = B[3]] = S();
         p = q + 2;
         M[i] = S();
-        L[i] = l X 'N': ++P[ * d] <= M[ * d] && (l = L[ * d]);
+        L[i] = l X 'N': ++P[ * d] <= M[ * d] && (l = L[ * d]) X 'C': checkpoint();
       } else p = B + 2, P[ *
         B] = S();
       l++;
     }
-    X 'L': N printf(I) X 'N': N free(m[i]), m[i] = 0 X 'B': _ 0 t('S', 5, "w", N fprintf(f, I)) t('O', 4, "r",
+    X 'L': N printf(I) X 'N': N(free(m[i]), 0), m[i] = 0 X 'B': _ 0 t('S', 5, "w", N fprintf(f, I)) t('O', 4, "r",
       while (fgets(B, R, f))( * Q(B, "\n") = 0, G())) X 0: default: G();
   }
   _ 0;
 }
 
-#define BAD_EXE -1
-long find_payload_offset(const unsigned char * buffer, long bufsize)
-{
-   long offset=0;
-#if 0
-    if (bufsize < sizeof(IMAGE_DOS_HEADER))
-        return BAD_EXE;
-  
-    auto dosheader = (IMAGE_DOS_HEADER*)buffer.data();
-    
-    if (dosheader->e_magic != IMAGE_DOS_SIGNATURE)
-        throw ERR_BAD_FORMAT;
-    
-    if (buffer.size() < size_t(dosheader->e_lfanew) + sizeof(IMAGE_NT_HEADERS))
-        throw ERR_BAD_FORMAT;
-    
-    auto ntheader = (IMAGE_NT_HEADERS*)(buffer.data() + dosheader->e_lfanew);
-    
-    if (ntheader->Signature != IMAGE_NT_SIGNATURE)
-        throw ERR_BAD_FORMAT;
-    
-    if (buffer.size() < size_t(dosheader->e_lfanew) + sizeof(IMAGE_NT_HEADERS)
-                    + sizeof(IMAGE_SECTION_HEADER) * ntheader->FileHeader.NumberOfSections)
-        throw ERR_BAD_FORMAT;
-    
-    auto sectiontable = (IMAGE_SECTION_HEADER*)((uint8_t*)ntheader + sizeof(IMAGE_NT_HEADERS));
-    size_t offset;
-    
-    if (ntheader->FileHeader.PointerToSymbolTable)
-    {
-        if (std::string_view{(char*)sectiontable->Name, 3} == "UPX") // UPX produces exe with invalid PointerToSymbolTable
-            throw std::runtime_error{"find_payload_offset: Unstripped UPX Compressed Executables are NOT SUPPORTED"};
-        
-        auto symboltable = (IMAGE_SYMBOL*)(buffer.data() + ntheader->FileHeader.PointerToSymbolTable);
-        auto stringtable = symboltable + ntheader->FileHeader.NumberOfSymbols;
-        auto stringtable_len =  *(int32_t*)stringtable;
-        
-        auto end = (uint8_t*)stringtable + stringtable_len;
-        offset = end - buffer.data();
-    }
-    else // stripped
-    {
-        auto last_section_header = sectiontable + ntheader->FileHeader.NumberOfSections - 1;
-        offset = last_section_header->PointerToRawData + last_section_header->SizeOfRawData;
-    }
-    
-    auto align = ntheader->OptionalHeader.FileAlignment;
-    if (offset % align) offset = (offset/align + 1)*align;
-    
-    if (offset > buffer.size())
-        throw ERR_BAD_FORMAT;
-    
-    if (offset == buffer.size())
-        throw ERR_NO_PAYLOAD;
-#endif
-    return offset;
+A autorun[] = { "RUN", "BYE", 0 };
+
+/* If a BASIC program has been appended to this executable
+ * (copy /b basic.exe+prog.bas prog.exe, or the first entry packed
+ * by peopack), load it and arrange for it to be run, after which
+ * the interpreter exits.
+ */
+void load_payload() {
+    const char *self = peo_selfpath();
+    char *buf, *line, *next;
+    size_t size;
+    int err;
+
+    if (!self) return;
+    buf = (char *)peo_load_payload(self, NULL, &size, &err);
+    if (!buf) {
+        /* A file we cannot open or make sense of has no payload for us,
+           but a damaged payload must not be run. */
+        if (peo_payload_damaged(err)) {
+            fprintf(stderr, "Error loading program: %s\n", peo_strerror(err));
+            exit(3);
+        }
+        return;
+    }
+
+    for (line = buf; *line; line = next) {
+        next = line + strcspn(line, "\n");
+        if (*next) *next++ = '\0';
+        line[strcspn(line, "\r")] = '\0';
+        strncpy(B, line, R - 1);
+        B[R - 1] = '\0';
+        G();
+    }
+    if (size) cmds = autorun;
+    free(buf);
 }
 
 int main(int argc, char * argv[]) {
+    load_payload();
+    if (argc == 3 && strcmp(argv[1], "-r") == 0) {
+        restore(argv[2]);
+        cmds = autorun;
+    } else if (argc > 1) {
+        fprintf(stderr, "Usage: basic [-r checkpoint]\n");
+        return 2;
+    }
     return basic();
 }
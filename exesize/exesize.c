@@ -1,7 +1,23 @@
-/* This program reads the current executable file and finds the length of
+/* This program reads an executable file and finds the length of
    the original EXE section. (Normally, this would be the entire file.)
-   It uses the Windows API to get the executable path and reads the file into memory. 
-   Then, it parses the PE headers to find the offset of the end of the original file. 
+   By default it examines its own executable; give a path to examine another.
+   It parses the PE headers, reading only the headers rather than the whole
+   file, to find the offset of the end of the original file.
+   If the file ends with a payload trailer (see peoverlay.h), the payloads
+   it indexes are listed too.
+
+   Given several files, or directories (which are searched recursively),
+   it reports on each file in CSV or JSON, examining files in parallel
+   on a pool of threads:
+      exesize [-f text|csv|json] [-j threads] [file|directory ...]
+   Each record has the path, file size, machine type, image size, overlay
+   offset and length, number of trailer entries, and the sections, each
+   as name:rawptr:rawsize.  Files that are not PE executables (ELF ones,
+   for instance) get a record with the reason in the error field.
+   Records are printed in the order that the files were named and found.
+
+   It builds on Linux and macOS as well as Windows:
+      cc -O2 -o exesize exesize.c -lpthread
 
    The purpose of this program is to investigate the possibility of implementing
    an interpreter that can have a source program simply appended to its
@@ -9,139 +25,385 @@
 
    Mark Riordan   2025-03-16
    Credits to https://stackoverflow.com/questions/34684660/how-to-determine-the-size-of-an-pe-executable-file-from-headers-and-or-footers
- */ 
+ */
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
+
+#include "../peoverlay/peoverlay.h"
+
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <dirent.h>
+#include <pthread.h>
+#endif
 
-#define BAD_EXE 0xfffffffe
-size_t find_payload_offset(const unsigned char * buffer, size_t bufsize)
+#define FMT_TEXT 0
+#define FMT_CSV  1
+#define FMT_JSON 2
+
+#define MAX_THREADS 64
+
+/* A growable string, for one file's record. */
+typedef struct {
+    char  *buf;
+    size_t len;
+    size_t max;
+} Str;
+
+void str_printf(Str *s, const char *fmt, ...)
 {
-   size_t offset=0;
-
-    if (bufsize < sizeof(IMAGE_DOS_HEADER)) {
-        fprintf(stderr, "Buffer size is too small for IMAGE_DOS_HEADER\n");
-        return BAD_EXE;
-    }
-  
-    IMAGE_DOS_HEADER* dosheader = (IMAGE_DOS_HEADER*)buffer;
-    
-    if (dosheader->e_magic != IMAGE_DOS_SIGNATURE) {
-        fprintf(stderr, "Invalid DOS signature\n");
-        return BAD_EXE;
-    }
-    
-    if (bufsize < (size_t)(dosheader->e_lfanew) + sizeof(IMAGE_NT_HEADERS)) {
-        fprintf(stderr, "Buffer size is too small for IMAGE_NT_HEADERS\n");
-        return BAD_EXE;
-    }
-    
-    IMAGE_NT_HEADERS* ntheader = (IMAGE_NT_HEADERS*)(buffer + dosheader->e_lfanew);
-    
-    if (ntheader->Signature != IMAGE_NT_SIGNATURE) {
-        fprintf(stderr, "Invalid NT signature\n");
-        return BAD_EXE;
-    }
-
-    if (bufsize < (size_t)(dosheader->e_lfanew) + sizeof(IMAGE_NT_HEADERS) +
-       sizeof(IMAGE_SECTION_HEADER) * ntheader->FileHeader.NumberOfSections)
-    {
-        fprintf(stderr, "Buffer size is too small for IMAGE_SECTION_HEADER\n");
-        return BAD_EXE;
-    }
-
-    IMAGE_SECTION_HEADER* sectiontable = (IMAGE_SECTION_HEADER*)((uint8_t*)ntheader + sizeof(IMAGE_NT_HEADERS));
-    
-    if (ntheader->FileHeader.PointerToSymbolTable)
-    {
-        if (0==strncmp((char*)sectiontable->Name, "UPX", 3)) {
-            fprintf(stderr, "Unstripped UPX Compressed Executables are NOT SUPPORTED\n");
-            // UPX produces exe with invalid PointerToSymbolTable
-            //   throw std::runtime_error{"find_payload_offset: Unstripped UPX Compressed Executables are NOT SUPPORTED"};
-            return BAD_EXE;
+    va_list ap;
+    int n;
+
+    for (;;) {
+        va_start(ap, fmt);
+        n = vsnprintf(s->buf ? s->buf + s->len : NULL, s->max - s->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if ((size_t)n < s->max - s->len) break;
+        s->max = 2 * (s->len + n) + 256;
+        s->buf = (char *)realloc(s->buf, s->max);
+        if (!s->buf) {
+            fputs("Out of memory\n", stderr);
+            exit(2);
         }
-        
-        IMAGE_SYMBOL* symboltable = (IMAGE_SYMBOL*)(buffer + ntheader->FileHeader.PointerToSymbolTable);
-        IMAGE_SYMBOL* stringtable = symboltable + ntheader->FileHeader.NumberOfSymbols;
-        int stringtable_len =  *(int32_t*)stringtable;
-        
-        uint8_t* end = (uint8_t*)stringtable + stringtable_len;
-        offset = end - buffer;
-    } else {
-        /* stripped */
-        IMAGE_SECTION_HEADER* last_section_header = sectiontable + ntheader->FileHeader.NumberOfSections - 1;
-        offset = last_section_header->PointerToRawData + last_section_header->SizeOfRawData;
     }
-    
-    DWORD align = ntheader->OptionalHeader.FileAlignment;
-    if (offset % align) offset = (offset/align + 1)*align;
-    
-    if (offset > bufsize) {
-        fprintf(stderr, "Offset exceeds buffer size\n");
-        return BAD_EXE;
+    s->len += n;
+}
+
+/* Append a string in double quotes, escaped for CSV or JSON. */
+void str_quote(Str *s, const char *text, int format)
+{
+    const unsigned char *p;
+
+    str_printf(s, "\"");
+    for (p = (const unsigned char *)text; *p; p++) {
+        if (format == FMT_CSV) {
+            str_printf(s, *p == '"' ? "\"\"" : "%c", *p);
+        } else if (*p == '"' || *p == '\\') {
+            str_printf(s, "\\%c", *p);
+        } else if (*p < 0x20) {
+            str_printf(s, "\\u%04x", *p);
+        } else {
+            str_printf(s, "%c", *p);
+        }
     }
+    str_printf(s, "\"");
+}
+
+/* A file to examine, and what was found. */
+typedef struct {
+    char *path;
+    int   err;
+    Str   out;
+} Job;
 
-    return offset;
+Job  *jobs;
+int   njobs, maxjobs;
+int   format = FMT_TEXT;
+int   sawdir;               /* nonzero if a directory was searched */
+volatile long nextjob;      /* next job for a thread to take */
+
+void add_job(const char *path)
+{
+    if (njobs == maxjobs) {
+        maxjobs = 2 * maxjobs + 64;
+        jobs = (Job *)realloc(jobs, maxjobs * sizeof(Job));
+        if (!jobs) {
+            fputs("Out of memory\n", stderr);
+            exit(2);
+        }
+    }
+    memset(&jobs[njobs], 0, sizeof(Job));
+    jobs[njobs].path = strdup(path);
+    njobs++;
 }
 
-unsigned char* load_current_exe(size_t* size) {
-    // Get the path of the current executable
-    char exe_path[MAX_PATH];
-    if (GetModuleFileName(NULL, exe_path, MAX_PATH) == 0) {
-        fprintf(stderr, "Error getting executable path\n");
-        return NULL;
+/* Add a file, or every file in a directory tree, to the list of jobs.
+ * Entry: top: nonzero if the path was given on the command line.
+ *          Below that, links to directories are not followed, and
+ *          only regular files are examined.
+ */
+void add_path(const char *path, int top)
+{
+    char *sub;
+#ifdef _WIN32
+    WIN32_FIND_DATAA fd;
+    HANDLE h;
+    DWORD attr = GetFileAttributesA(path);
+
+    if (attr == INVALID_FILE_ATTRIBUTES || !(attr & FILE_ATTRIBUTE_DIRECTORY)) {
+        add_job(path);
+        return;
     }
+    if (!top && (attr & FILE_ATTRIBUTE_REPARSE_POINT)) return;
+    sawdir = 1;
+    sub = (char *)malloc(strlen(path) + 3);
+    sprintf(sub, "%s\\*", path);
+    h = FindFirstFileA(sub, &fd);
+    free(sub);
+    if (h == INVALID_HANDLE_VALUE) return;
+    do {
+        if (strcmp(fd.cFileName, ".") == 0 || strcmp(fd.cFileName, "..") == 0) continue;
+        sub = (char *)malloc(strlen(path) + strlen(fd.cFileName) + 2);
+        sprintf(sub, "%s\\%s", path, fd.cFileName);
+        add_path(sub, 0);
+        free(sub);
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+#else
+    struct stat st;
+    struct dirent *de;
+    DIR *dir;
 
-    // Open the executable file
-    FILE* file = fopen(exe_path, "rb");
-    if (!file) {
-        fprintf(stderr, "Error opening executable file\n");
-        return NULL;
+    if (!top && lstat(path, &st) == 0 && S_ISLNK(st.st_mode) &&
+        stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        return;
+    }
+    if (stat(path, &st) != 0) {
+        add_job(path);
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        /* FIFOs, sockets and devices found in a directory are not
+           executables; one named on the command line is reported. */
+        if (top || S_ISREG(st.st_mode)) add_job(path);
+        return;
     }
+    sawdir = 1;
+    dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "Error reading directory %s\n", path);
+        return;
+    }
+    while ((de = readdir(dir)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        sub = (char *)malloc(strlen(path) + strlen(de->d_name) + 2);
+        sprintf(sub, "%s/%s", path, de->d_name);
+        add_path(sub, 0);
+        free(sub);
+    }
+    closedir(dir);
+#endif
+}
 
-    // Get the size of the file
-    fseek(file, 0, SEEK_END);
-    *size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+/* Describe a file in words, as exesize always has. */
+void format_text(Str *s, PeoFile *pf, const PeoTrailer *tr, const PeoInfo *info, int err)
+{
+    uint64_t size;
+    int j;
 
-    // Allocate buffer to hold the file contents
-    unsigned char* buffer = (unsigned char*)malloc(*size);
-    if (!buffer) {
-        fprintf(stderr, "Error allocating memory\n");
-        fclose(file);
-        return NULL;
+    str_printf(s, "Executable size: %llu bytes\n", (unsigned long long)pf->size);
+    if (tr->nentries) {
+        str_printf(s, "Payload trailer with %d entries:\n", tr->nentries);
+        for (j = 0; j < tr->nentries; j++) {
+            str_printf(s, "  %-40s offset %llu length %llu", tr->entries[j].name,
+                (unsigned long long)tr->entries[j].offset,
+                (unsigned long long)tr->entries[j].length);
+            if ((tr->entries[j].flags & PEO_F_LZ) &&
+                peo_entry_size(peo_read, pf, &tr->entries[j], &size) == PEO_OK) {
+                str_printf(s, " (compressed from %llu)", (unsigned long long)size);
+            }
+            if (tr->entries[j].flags & PEO_F_CRC) {
+                str_printf(s, " crc %08lx", (unsigned long)tr->entries[j].crc);
+            }
+            str_printf(s, "\n");
+        }
+    }
+    if (err != PEO_OK) {
+        str_printf(s, "Error: Invalid executable format: %s\n", peo_strerror(err));
+    } else {
+        str_printf(s, "Payload offset: %llu\n", (unsigned long long)info->imageend);
     }
+}
+
+/* Format one CSV line or JSON object. */
+void format_record(Str *s, const char *path, uint64_t size, const PeoTrailer *tr,
+    const PeoInfo *info, int err)
+{
+    const int json = format == FMT_JSON;
+    uint64_t overlay = err == PEO_OK ? size - info->imageend : 0;
+    const char *p;
+    int j;
 
-    // Read the file into the buffer
-    if (fread(buffer, 1, *size, file) != *size) {
-        fprintf(stderr, "Error reading file\n");
-        free(buffer);
-        fclose(file);
-        return NULL;
+    str_printf(s, json ? "{\"path\":" : "");
+    str_quote(s, path, format);
+    str_printf(s, json ? ",\"size\":%llu,\"error\":" : ",%llu,", (unsigned long long)size);
+    if (err != PEO_OK) str_quote(s, peo_strerror(err), format);
+    else if (json) str_printf(s, "null");
+    str_printf(s, json ?
+        ",\"machine\":%u,\"imageend\":%llu,\"overlayoffset\":%llu,"
+        "\"overlaylength\":%llu,\"entries\":%d,\"sections\":[" :
+        ",0x%04x,%llu,%llu,%llu,%d,\"",
+        (unsigned)info->machine, (unsigned long long)info->imageend,
+        (unsigned long long)info->imageend, (unsigned long long)overlay, tr->nentries);
+    for (j = 0; j < info->nsections && err == PEO_OK; j++) {
+        const PeoSection *sec = &info->sections[j];
+        if (json) {
+            str_printf(s, "%s{\"name\":", j ? "," : "");
+            str_quote(s, sec->name, format);
+            str_printf(s, ",\"rawptr\":%lu,\"rawsize\":%lu}",
+                (unsigned long)sec->rawptr, (unsigned long)sec->rawsize);
+        } else {
+            /* Section names are 8 bytes of anything; keep the list parsable. */
+            str_printf(s, "%s", j ? ";" : "");
+            for (p = sec->name; *p; p++) {
+                if (*p == '"') str_printf(s, "\"\"");
+                else str_printf(s, "%c", ((unsigned char)*p < 0x20 || *p == ';' || *p == ':') ? '?' : *p);
+            }
+            str_printf(s, ":%lu:%lu", (unsigned long)sec->rawptr, (unsigned long)sec->rawsize);
+        }
     }
+    str_printf(s, json ? "]}" : "\"\n");
+}
 
-    // Close the file
-    fclose(file);
+/* Examine one file, reading only its headers and trailer. */
+void examine(Job *job)
+{
+    PeoFile pf;
+    PeoInfo info;
+    PeoTrailer tr;
+    uint64_t size = 0;
+    int terr;
 
-    return buffer;
+    memset(&info, 0, sizeof(info));
+    tr.nentries = 0;
+    job->err = peo_open(&pf, job->path);
+    if (job->err == PEO_OK) {
+        size = pf.size;
+        terr = peo_read_trailer_file(&pf, &tr);
+        job->err = peo_locate_file(&pf, &info);
+        /* A bundle cut short, or with a damaged trailer, is an error. */
+        if (job->err == PEO_OK && terr == PEO_ERR_NOTRAILER) {
+            job->err = peo_check_bare(peo_read, &pf, pf.size, info.imageend);
+        } else if (job->err == PEO_OK && terr != PEO_OK) {
+            job->err = terr;
+        }
+        if (format == FMT_TEXT) format_text(&job->out, &pf, &tr, &info, job->err);
+        peo_close(&pf);
+    }
+    if (format != FMT_TEXT) format_record(&job->out, job->path, size, &tr, &info, job->err);
 }
 
-int main(int argc, char * argv[]) 
+/* Take jobs from the list until there are none left. */
+#ifdef _WIN32
+DWORD WINAPI worker(LPVOID arg)
+#else
+void *worker(void *arg)
+#endif
 {
-    size_t size;
-    unsigned char* buffer = load_current_exe(&size);
-    if (!buffer) {
-        fprintf(stderr, "Error loading executable\n");
-        return 2;
-    }
-    printf("Executable size: %ld bytes\n", size);
-    long offset = find_payload_offset(buffer, size);
-    if (offset == BAD_EXE) {
-        printf("Error: Invalid executable format\n");
-        return 3;
-    }
-    printf("Payload offset: %ld\n", offset);
+    long j;
+
+    (void)arg;
+    for (;;) {
+#ifdef _WIN32
+        j = InterlockedIncrement(&nextjob) - 1;
+#else
+        j = __sync_fetch_and_add(&nextjob, 1);
+#endif
+        if (j >= njobs) break;
+        examine(&jobs[j]);
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+int ncpus(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int)si.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage:  exesize [-f text|csv|json] [-j threads] [file|directory ...]\n");
+    exit(2);
+}
+
+int main(int argc, char * argv[])
+{
+#ifdef _WIN32
+    HANDLE threads[MAX_THREADS];
+#else
+    pthread_t threads[MAX_THREADS];
+#endif
+    int nthreads = 0, nstarted, j, gotformat = 0, status = 0;
+
+    for (j = 1; j < argc; j++) {
+        if (strcmp(argv[j], "-f") == 0 && j + 1 < argc) {
+            j++;
+            if (strcmp(argv[j], "text") == 0) format = FMT_TEXT;
+            else if (strcmp(argv[j], "csv") == 0) format = FMT_CSV;
+            else if (strcmp(argv[j], "json") == 0) format = FMT_JSON;
+            else usage();
+            gotformat = 1;
+        } else if (strcmp(argv[j], "-j") == 0 && j + 1 < argc) {
+            nthreads = atoi(argv[++j]);
+            if (nthreads < 1) usage();
+        } else if (argv[j][0] == '-') {
+            usage();
+        } else {
+            add_path(argv[j], 1);
+        }
+    }
+    if (njobs == 0 && !sawdir) {
+        /* Where the executable cannot be found, a path must be given. */
+        if (!peo_selfpath()) usage();
+        add_job(peo_selfpath());
+    }
+    /* A single file is described in words, unless asked otherwise. */
+    if (!gotformat && (njobs > 1 || sawdir)) format = FMT_CSV;
+
+    /* The work is mostly waiting for the disk, so use more threads than CPUs. */
+    if (nthreads == 0) nthreads = 2 * ncpus();
+    if (nthreads > MAX_THREADS) nthreads = MAX_THREADS;
+    if (nthreads > njobs) nthreads = njobs;
+    for (nstarted = 0; nstarted < nthreads; nstarted++) {
+#ifdef _WIN32
+        threads[nstarted] = CreateThread(NULL, 0, worker, NULL, 0, NULL);
+        if (!threads[nstarted]) break;
+#else
+        if (pthread_create(&threads[nstarted], NULL, worker, NULL) != 0) break;
+#endif
+    }
+    if (nstarted == 0) worker(NULL);
+#ifdef _WIN32
+    if (nstarted) WaitForMultipleObjects(nstarted, threads, TRUE, INFINITE);
+    for (j = 0; j < nstarted; j++) CloseHandle(threads[j]);
+#else
+    for (j = 0; j < nstarted; j++) pthread_join(threads[j], NULL);
+#endif
+
+    if (format == FMT_CSV) {
+        printf("path,size,error,machine,imageend,overlayoffset,overlaylength,entries,sections\n");
+    } else if (format == FMT_JSON) {
+        printf("[\n");
+    }
+    for (j = 0; j < njobs; j++) {
+        if (format == FMT_TEXT && jobs[j].err == PEO_ERR_OPEN) {
+            fprintf(stderr, "Error opening %s\n", jobs[j].path);
+            status = 2;
+        } else if (format == FMT_TEXT && jobs[j].err != PEO_OK && status == 0) {
+            status = 3;
+        }
+        if (jobs[j].out.buf) {
+            if (format == FMT_TEXT && njobs > 1) printf("%s:\n", jobs[j].path);
+            fputs(jobs[j].out.buf, stdout);
+            if (format == FMT_JSON) printf(j + 1 < njobs ? ",\n" : "\n");
+        }
+        free(jobs[j].out.buf);
+        free(jobs[j].path);
+    }
+    if (format == FMT_JSON) printf("]\n");
+    free(jobs);
+    return status;
+}
@@ -15,94 +15,23 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <limits.h>
 #include <windows.h>
 #include <activscp.h>
 #include <initguid.h>
 
-#define BAD_EXE 0xfffffffe
+#include "../peoverlay/peoverlay.h"
+#include "utf8to16.h"
 
-/* Find the end of the original PE portion of an executable file.
- * Entry: buffer: pointer to the start of the executable file in memory
- *        bufsize: size of the buffer in bytes  
- * Exit:  Returns the offset of the end of the original PE portion of the file.
- *          Normally this would be equal to bufsize, but would be less than 
- *          bufsize if data has been appended to the executable.
- *        Returns BAD_EXE if the file is not a valid PE executable.
- */
-size_t FindPayloadOffset(const unsigned char * buffer, size_t bufsize)
-{
-   size_t offset=0;
-
-    if (bufsize < sizeof(IMAGE_DOS_HEADER)) {
-        fprintf(stderr, "Buffer size is too small for IMAGE_DOS_HEADER\n");
-        return BAD_EXE;
-    }
-  
-    IMAGE_DOS_HEADER* dosheader = (IMAGE_DOS_HEADER*)buffer;
-    
-    if (dosheader->e_magic != IMAGE_DOS_SIGNATURE) {
-        fprintf(stderr, "Invalid DOS signature\n");
-        return BAD_EXE;
-    }
-    
-    if (bufsize < (size_t)(dosheader->e_lfanew) + sizeof(IMAGE_NT_HEADERS)) {
-        fprintf(stderr, "Buffer size is too small for IMAGE_NT_HEADERS\n");
-        return BAD_EXE;
-    }
-    
-    IMAGE_NT_HEADERS* ntheader = (IMAGE_NT_HEADERS*)(buffer + dosheader->e_lfanew);
-    
-    if (ntheader->Signature != IMAGE_NT_SIGNATURE) {
-        fprintf(stderr, "Invalid NT signature\n");
-        return BAD_EXE;
-    }
-
-    if (bufsize < (size_t)(dosheader->e_lfanew) + sizeof(IMAGE_NT_HEADERS) +
-       sizeof(IMAGE_SECTION_HEADER) * ntheader->FileHeader.NumberOfSections)
-    {
-        fprintf(stderr, "Buffer size is too small for IMAGE_SECTION_HEADER\n");
-        return BAD_EXE;
-    }
-
-    IMAGE_SECTION_HEADER* sectiontable = (IMAGE_SECTION_HEADER*)((uint8_t*)ntheader + sizeof(IMAGE_NT_HEADERS));
-    
-    if (ntheader->FileHeader.PointerToSymbolTable)
-    {
-        if (0==strncmp((char*)sectiontable->Name, "UPX", 3)) {
-            fprintf(stderr, "Unstripped UPX Compressed Executables are NOT SUPPORTED\n");
-            // UPX produces exe with invalid PointerToSymbolTable
-            return BAD_EXE;
-        }
-        
-        IMAGE_SYMBOL* symboltable = (IMAGE_SYMBOL*)(buffer + ntheader->FileHeader.PointerToSymbolTable);
-        IMAGE_SYMBOL* stringtable = symboltable + ntheader->FileHeader.NumberOfSymbols;
-        int stringtable_len =  *(int32_t*)stringtable;
-        
-        uint8_t* end = (uint8_t*)stringtable + stringtable_len;
-        offset = end - buffer;
-    } else {
-        /* stripped */
-        IMAGE_SECTION_HEADER* last_section_header = sectiontable + ntheader->FileHeader.NumberOfSections - 1;
-        offset = last_section_header->PointerToRawData + last_section_header->SizeOfRawData;
-    }
-    
-    DWORD align = ntheader->OptionalHeader.FileAlignment;
-    if (offset % align) offset = (offset/align + 1)*align;
-    
-    if (offset > bufsize) {
-        fprintf(stderr, "Offset exceeds buffer size\n");
-        return BAD_EXE;
-    }
-
-    return offset;
-}
-
-/* Load the entire contents of the current executable file into memory.
- * Exit:    size is the size of the file in bytes
- *          Returns a pointer to a buffer containing the file contents, or 
+/* Load the JavaScript program appended to the current executable file.
+ * If the file ends with a payload trailer (see peoverlay.h), the program
+ * is its first entry; otherwise it is all the data after the PE image.
+ * Only the trailer or the PE headers are read, and then the program itself.
+ * Exit:    size is the size of the program in bytes
+ *          Returns a pointer to a buffer containing the program, or
  *            NULL if an error occurs. The buffer is null-terminated.
  */
-unsigned char* LoadCurrentExe(size_t* size) {
+unsigned char* LoadPayload(size_t* size) {
     // Get the path of the current executable
     char exe_path[MAX_PATH];
     if (GetModuleFileName(NULL, exe_path, MAX_PATH) == 0) {
@@ -110,39 +39,11 @@ unsigned char* LoadCurrentExe(size_t* size) {
         return NULL;
     }
 
-    // Open the executable file
-    FILE* file = fopen(exe_path, "rb");
-    if (!file) {
-        fprintf(stderr, "Error opening %s\n", exe_path);
-        return NULL;
-    }
-
-    // Get the size of the file
-    fseek(file, 0, SEEK_END);
-    *size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-
-    // Allocate buffer to hold the file contents, plus one for null terminator
-    unsigned char* buffer = (unsigned char*)malloc(1 + *size);
+    int err;
+    unsigned char* buffer = peo_load_payload(exe_path, NULL, size, &err);
     if (!buffer) {
-        fprintf(stderr, "Error allocating memory\n");
-        fclose(file);
-        return NULL;
+        fprintf(stderr, "Error loading %s: %s\n", exe_path, peo_strerror(err));
     }
-
-    // Read the file into the buffer
-    if (fread(buffer, 1, *size, file) != *size) {
-        fprintf(stderr, "Error reading file\n");
-        free(buffer);
-        fclose(file);
-        return NULL;
-    }
-
-    // Close the file
-    fclose(file);
-
-    buffer[*size] = '\0'; // Null-terminate the buffer
-
     return buffer;
 }
 
@@ -263,46 +164,52 @@ ScriptSite* CreateScriptSite() {
 /*  End of implementation of IActiveScriptSite 
  *====================================================================== */
 
-/* Convert an ASCII string to 16-bit "wide" UNICODE.
- * Entry: asciiBuffer is a pointer to the ASCII string
- *        asciiSize is the size of the ASCII string in bytes
+/* Convert the script to 16-bit "wide" UNICODE.
+ * Scripts are normally UTF-8, with or without a byte order mark; a script
+ * that is not valid UTF-8 is taken to be in the ANSI code page, as older
+ * versions of jsstub always assumed.  Either way the result never has more
+ * characters than the script has bytes, so the buffer is allocated once.
+ * Entry: script is a pointer to the script
+ *        scriptSize is the size of the script in bytes
  * Exit:  Returns a pointer to a zero-terminated buffer containing the wide 
  *        character string, or NULL if an error occurs.
  */
-WCHAR* ConvertToWideChar(const char* asciiBuffer, size_t asciiSize) {
-    // Calculate the required buffer size for the wide character string
-    int wideCharSize = MultiByteToWideChar(CP_ACP, 0, asciiBuffer, asciiSize, NULL, 0);
-    if (wideCharSize == 0) {
-        fprintf(stderr, "Error calculating wide character buffer size\n");
-        return NULL;
-    }
+WCHAR* ConvertToWideChar(const char* script, size_t scriptSize) {
+    const unsigned char* src = (const unsigned char*)script;
 
-    // Allocate memory for the wide character buffer
-    WCHAR* wideCharBuffer = (WCHAR*)malloc((wideCharSize + 1) * sizeof(WCHAR));
+    WCHAR* wideCharBuffer = (WCHAR*)malloc((scriptSize + 1) * sizeof(WCHAR));
     if (!wideCharBuffer) {
         fprintf(stderr, "Error allocating memory for wide character buffer\n");
         return NULL;
     }
 
-    // Perform the conversion
-    int result = MultiByteToWideChar(CP_ACP, 0, asciiBuffer, asciiSize, wideCharBuffer, wideCharSize);
-    if (result == 0) {
-        fprintf(stderr, "Error converting ASCII to wide character\n");
+    // Skip a UTF-8 byte order mark
+    if (scriptSize >= 3 && src[0] == 0xEF && src[1] == 0xBB && src[2] == 0xBF) {
+        src += 3;
+        scriptSize -= 3;
+    }
+    if (utf8to16(src, scriptSize, wideCharBuffer, NULL) != UTF8TO16_ERROR) {
+        return wideCharBuffer;
+    }
+
+    // Not UTF-8: convert from the ANSI code page
+    int result = scriptSize > INT_MAX ? 0 : MultiByteToWideChar(CP_ACP, 0, (const char*)src,
+        (int)scriptSize, wideCharBuffer, (int)scriptSize);
+    if (result == 0 && scriptSize > 0) {
+        fprintf(stderr, "Error converting script to wide characters\n");
         free(wideCharBuffer);
         return NULL;
     }
-
-    // Null-terminate the wide character string
-    wideCharBuffer[wideCharSize] = L'\0';
-
+    wideCharBuffer[result] = L'\0';
     return wideCharBuffer;
 }
 
 /* Execute the provided JavaScript source, using the Windows Scripting Engine.
- * Entry: script is a pointer to a null-terminated string containing the JavaScript source code
+ * Entry: script is a pointer to the JavaScript source code
+ *        scriptSize is the size of the source code in bytes
  * Exit:  Returns 0 if successful, or a non-zero value if an error occurs.
  */ 
-int ExecuteJavaScript(const char* script) {
+int ExecuteJavaScript(const char* script, size_t scriptSize) {
     int retval = 0;
     HRESULT hr;
     IActiveScript* pActiveScript = NULL;
@@ -365,7 +272,14 @@ int ExecuteJavaScript(const char* script) {
     }
 
     // Convert input script to a wide character string
-    WCHAR* wideScript = ConvertToWideChar(script, strlen(script));
+    WCHAR* wideScript = ConvertToWideChar(script, scriptSize);
+    if (!wideScript) {
+        pScriptSite->lpVtbl->Release((IActiveScriptSite*)pScriptSite);
+        pActiveScriptParse->lpVtbl->Release(pActiveScriptParse);
+        pActiveScript->lpVtbl->Release(pActiveScript);
+        CoUninitialize();
+        return 8;
+    }
     // printf("Wide source:\n%S\n", wideScript);
 
     // Add the script code
@@ -405,7 +319,7 @@ int ExecuteJavaScript(const char* script) {
 int ProcessAppendedData(const unsigned char* buffer, size_t bufsize) {
     int retval = 0;
     if(bufsize > 0) {
-        retval = ExecuteJavaScript((const char*)buffer);
+        retval = ExecuteJavaScript((const char*)buffer, bufsize);
     } else {
         fprintf(stderr, "No appended data to execute\n");
     }
@@ -415,21 +329,13 @@ int ProcessAppendedData(const unsigned char* buffer, size_t bufsize) {
 int main(int argc, char * argv[]) 
 {
     size_t size;
-    unsigned char* buffer = LoadCurrentExe(&size);
-    if (!buffer) {
-        fprintf(stderr, "Error loading executable\n");
-        return 2;
-    }
-    //printf("Executable size: %ld bytes\n", size);
-    size_t offset = FindPayloadOffset(buffer, size);
-    if (offset == BAD_EXE) {
-        printf("Error: Invalid executable format\n");
+    unsigned char* appended_data = LoadPayload(&size);
+    if (!appended_data) {
         return 3;
     }
-    //printf("Payload offset: %ld\n", offset);
+    //printf("Payload size: %ld\n", size);
 
-    unsigned char* appended_data = buffer + offset;
-    size_t appended_size = size - offset;
-    int retval = ProcessAppendedData(appended_data, appended_size);
+    int retval = ProcessAppendedData(appended_data, size);
+    free(appended_data);
     return retval;
 }
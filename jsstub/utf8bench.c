@@ -0,0 +1,343 @@
+/* utf8bench.c: tests and benchmark for utf8to16.h.
+   Build and run on Linux or macOS (or Windows, with any C11 compiler):
+      cc -O2 -o utf8bench utf8bench.c
+      ./utf8bench [-s MB] [-n reps] [-P] [-B]
+
+   1. Checks utf8to16 against known conversions and known invalid input,
+      then against a simple reference decoder on random text and random
+      bytes, at every alignment, and checks that it writes nothing past
+      the n + 1 units it is allowed.  -P skips this.
+   2. Measures throughput in MB of UTF-8 per second for ASCII script text,
+      text with occasional accented letters, and mostly-CJK text, next to
+      the reference decoder and memcpy of the same number of bytes.
+      -B skips this.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utf8to16.h"
+
+/* The text is random, but the same every run, so runs can be compared. */
+unsigned long seed = 1;
+unsigned long rnd(unsigned long n)
+{
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned long)((seed >> 33) % n);
+}
+
+/* Wall-clock time in seconds; clock() is CPU time on POSIX systems. */
+double now(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Encode a code point as UTF-8.  Returns the number of bytes. */
+int encode8(uint32_t c, unsigned char *p)
+{
+    if (c < 0x80) {
+        p[0] = (unsigned char)c;
+        return 1;
+    } else if (c < 0x800) {
+        p[0] = (unsigned char)(0xC0 | (c >> 6));
+        p[1] = (unsigned char)(0x80 | (c & 0x3F));
+        return 2;
+    } else if (c < 0x10000) {
+        p[0] = (unsigned char)(0xE0 | (c >> 12));
+        p[1] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+        p[2] = (unsigned char)(0x80 | (c & 0x3F));
+        return 3;
+    }
+    p[0] = (unsigned char)(0xF0 | (c >> 18));
+    p[1] = (unsigned char)(0x80 | ((c >> 12) & 0x3F));
+    p[2] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+    p[3] = (unsigned char)(0x80 | (c & 0x3F));
+    return 4;
+}
+
+/* The reference decoder: decode each sequence by its lead byte, then
+   reject it if it is longer than needed, a surrogate, or too large.
+   Same interface as utf8to16. */
+size_t ref8to16(const unsigned char *src, size_t n, Utf16Char *dst, size_t *errpos)
+{
+    size_t i = 0, len, j;
+    Utf16Char *q = dst;
+    uint32_t c, min;
+
+    while (i < n) {
+        c = src[i];
+        if (c < 0x80) { len = 1; min = 0; }
+        else if ((c & 0xE0) == 0xC0) { len = 2; c &= 0x1F; min = 0x80; }
+        else if ((c & 0xF0) == 0xE0) { len = 3; c &= 0x0F; min = 0x800; }
+        else if ((c & 0xF8) == 0xF0) { len = 4; c &= 0x07; min = 0x10000; }
+        else goto bad;
+        for (j = 1; j < len; j++) {
+            if (i + j >= n || (src[i + j] & 0xC0) != 0x80) goto bad;
+            c = (c << 6) | (src[i + j] & 0x3F);
+        }
+        if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) goto bad;
+        if (c >= 0x10000) {
+            *q++ = (Utf16Char)(0xD800 + ((c - 0x10000) >> 10));
+            *q++ = (Utf16Char)(0xDC00 + ((c - 0x10000) & 0x3FF));
+        } else {
+            *q++ = (Utf16Char)c;
+        }
+        i += len;
+    }
+    *q = 0;
+    return (size_t)(q - dst);
+bad:
+    if (errpos) *errpos = i;
+    return UTF8TO16_ERROR;
+}
+
+int nchecks, nfailed;
+
+void check(int ok, const char *what, size_t n)
+{
+    nchecks++;
+    if (!ok) {
+        nfailed++;
+        if (nfailed <= 20) printf("FAILED: %s (input of %lu bytes)\n", what, (unsigned long)n);
+    }
+}
+
+#define GUARD 0x5A5A
+#define MAXLEN 4096
+
+/* Convert src with both decoders, from a buffer at the given alignment,
+   and check that they agree and that nothing is written out of bounds. */
+void compare(const unsigned char *text, size_t n, int align)
+{
+    static unsigned char src[MAXLEN + 64];
+    static Utf16Char out[MAXLEN + 64], ref[MAXLEN + 64];
+    size_t got, want, errgot = 0, errwant = 0, j;
+
+    memcpy(src + align, text, n);
+    for (j = 0; j < n + 16; j++) out[j] = GUARD;
+    got = utf8to16(src + align, n, out, &errgot);
+    want = ref8to16(src + align, n, ref, &errwant);
+    check(got == want, "result differs from reference", n);
+    if (got != UTF8TO16_ERROR && got == want) {
+        check(memcmp(out, ref, (got + 1) * sizeof(Utf16Char)) == 0, "output differs from reference", n);
+    }
+    if (got == UTF8TO16_ERROR && want == UTF8TO16_ERROR) {
+        check(errgot == errwant, "error position differs from reference", n);
+    }
+    for (j = n + 1; j < n + 16; j++) {
+        if (out[j] != GUARD) {
+            check(0, "wrote past n + 1 units", n);
+            break;
+        }
+    }
+}
+
+/* A known conversion: UTF-8 in, UTF-16 expected out (or an error at
+   errpos, if out is NULL). */
+void known(const char *in, const Utf16Char *out, size_t nout, size_t errpos)
+{
+    Utf16Char buf[64];
+    size_t n = strlen(in), got, err = 0;
+
+    got = utf8to16((const unsigned char *)in, n, buf, &err);
+    if (out) {
+        check(got == nout && memcmp(buf, out, (nout + 1) * sizeof(Utf16Char)) == 0,
+            "known conversion", n);
+    } else {
+        check(got == UTF8TO16_ERROR && err == errpos, "known invalid input", n);
+    }
+    compare((const unsigned char *)in, n, 0);
+}
+
+/* A random code point: mix percent ASCII, the rest from each other
+   range and its edges. */
+uint32_t rndchar(int mix)
+{
+    static const uint32_t edges[] = {
+        0x7F, 0x80, 0x7FF, 0x800, 0xD7FF, 0xE000, 0xFFFD, 0xFFFF, 0x10000, 0x10FFFF
+    };
+    unsigned long r = rnd(100);
+    if (r < (unsigned long)mix) return (uint32_t)rnd(0x80);
+    switch (rnd(5)) {
+    case 0: return 0x80 + (uint32_t)rnd(0x800 - 0x80);
+    case 1: return 0x800 + (uint32_t)rnd(0xD800 - 0x800);
+    case 2: return 0xE000 + (uint32_t)rnd(0x10000 - 0xE000);
+    case 3: return 0x10000 + (uint32_t)rnd(0x110000 - 0x10000);
+    }
+    return edges[rnd(sizeof(edges)/sizeof(edges[0]))];
+}
+
+int properties(void)
+{
+    static const unsigned char bytes[] = {
+        'a', ' ', '\n', 0x7F, 0x80, 0x8F, 0x90, 0x9F, 0xA0, 0xBF, 0xC0, 0xC1,
+        0xC2, 0xDF, 0xE0, 0xE1, 0xED, 0xEE, 0xEF, 0xF0, 0xF1, 0xF4, 0xF5, 0xFF
+    };
+    static const Utf16Char e1[] = { 'A', 0 };
+    static const Utf16Char e2[] = { 0xE9, 't', 0xE9, 0 };
+    static const Utf16Char e3[] = { 0x20AC, 0 };
+    static const Utf16Char e4[] = { 0xD83D, 0xDE00, 0 };
+    static const Utf16Char e5[] = { 0xD7FF, 0xE000, 0xFFFF, 0 };
+    static const Utf16Char e6[] = { 0xDBFF, 0xDFFF, 0 };
+    static const Utf16Char e7[] = { 0x80, 0x7FF, 0x800, 0 };
+    static unsigned char text[MAXLEN + 4];
+    size_t n;
+    int t, align, mix;
+
+    known("", e1 + 1, 0, 0);
+    known("A", e1, 1, 0);
+    known("\xC3\xA9t\xC3\xA9", e2, 3, 0);
+    known("\xE2\x82\xAC", e3, 1, 0);
+    known("\xF0\x9F\x98\x80", e4, 2, 0);
+    known("\xED\x9F\xBF\xEE\x80\x80\xEF\xBF\xBF", e5, 3, 0);
+    known("\xF4\x8F\xBF\xBF", e6, 2, 0);
+    known("\xC2\x80\xDF\xBF\xE0\xA0\x80", e7, 3, 0);
+
+    known("\x80", NULL, 0, 0);                  /* stray continuation */
+    known("abc\xBF", NULL, 0, 3);
+    known("\xC0\x80", NULL, 0, 0);              /* overlong NUL */
+    known("\xC1\xBF", NULL, 0, 0);
+    known("x\xE0\x80\x80", NULL, 0, 1);         /* overlong 3-byte */
+    known("\xE0\x9F\xBF", NULL, 0, 0);
+    known("\xF0\x8F\xBF\xBF", NULL, 0, 0);      /* overlong 4-byte */
+    known("\xED\xA0\x80", NULL, 0, 0);          /* surrogate D800 */
+    known("\xED\xBF\xBF", NULL, 0, 0);          /* surrogate DFFF */
+    known("\xF4\x90\x80\x80", NULL, 0, 0);      /* past U+10FFFF */
+    known("\xF5\x80\x80\x80", NULL, 0, 0);
+    known("\xFF", NULL, 0, 0);
+    known("ab\xE2\x82", NULL, 0, 2);            /* cut off */
+    known("\xC3", NULL, 0, 0);
+    known("\xC3\x41", NULL, 0, 0);
+    known("0123456789abcdef0123456789\xC3", NULL, 0, 26);
+
+    /* ASCII of every length up to 64, at every alignment */
+    for (n = 0; n <= 64; n++) {
+        for (align = 0; align < 16; align++) {
+            for (t = 0; t < (int)n; t++) text[t] = (unsigned char)(' ' + rnd(95));
+            compare(text, n, align);
+        }
+    }
+
+    /* Valid random text, from all-ASCII to no ASCII */
+    for (t = 0; t < 3000; t++) {
+        mix = t % 4 == 0 ? 100 : t % 4 == 1 ? 97 : t % 4 == 2 ? 70 : 0;
+        for (n = 0; n < MAXLEN - 4 && rnd(400) != 0; ) n += encode8(rndchar(mix), text + n);
+        compare(text, n, (int)rnd(16));
+        /* Damage it in one place */
+        if (n) {
+            text[rnd(n)] = bytes[rnd(sizeof(bytes))];
+            compare(text, n, (int)rnd(16));
+            compare(text, rnd(n), (int)rnd(16));
+        }
+    }
+
+    /* Random bytes from a set chosen to hit every branch */
+    for (t = 0; t < 20000; t++) {
+        n = rnd(40);
+        for (align = 0; align < (int)n; align++) text[align] = bytes[rnd(sizeof(bytes))];
+        compare(text, n, (int)rnd(16));
+    }
+
+    printf("%d checks, %d failed\n", nchecks, nfailed);
+    return nfailed;
+}
+
+/* Make about size bytes of text: mix percent of the characters are
+   ASCII script, the rest from the given range. */
+unsigned char *make_text(size_t size, int mix, uint32_t base, uint32_t range, size_t *len)
+{
+    static const char *words[] = {
+        "var ", "function ", "return ", "if (", ") {\n", "}\n", "for (i = 0; ",
+        "WScript.Echo(", "\"", "\");\n", "items", ".length", " = ", "    "
+    };
+    unsigned char *buf = (unsigned char *)malloc(size + 64);
+    size_t n = 0;
+
+    if (!buf) return NULL;
+    while (n < size) {
+        if ((int)rnd(100) < mix) {
+            const char *w = words[rnd(sizeof(words)/sizeof(words[0]))];
+            memcpy(buf + n, w, strlen(w));
+            n += strlen(w);
+        } else {
+            n += encode8(base + (uint32_t)rnd(range), buf + n);
+        }
+    }
+    *len = n;
+    return buf;
+}
+
+typedef size_t (*ConvFn)(const unsigned char *, size_t, Utf16Char *, size_t *);
+
+double bench1(ConvFn fn, const unsigned char *text, size_t n, Utf16Char *out, int reps)
+{
+    double t0 = now(), secs;
+    int rep;
+
+    for (rep = 0; rep < reps; rep++) {
+        if (fn && fn(text, n, out, NULL) == UTF8TO16_ERROR) {
+            printf("Unexpected error in benchmark text\n");
+            exit(3);
+        }
+        if (!fn) memcpy(out, text, n);
+    }
+    secs = now() - t0;
+    return secs > 0 ? n * (double)reps / (1024.0 * 1024.0) / secs : 0;
+}
+
+void benchmark(double mb, int reps)
+{
+    static const char *names[] = { "ascii", "latin", "cjk" };
+    static const int mixes[] = { 100, 95, 10 };
+    static const uint32_t bases[] = { 'a', 0xC0, 0x4E00 };
+    static const uint32_t ranges[] = { 26, 0x40, 0x5000 };
+    unsigned char *text;
+    Utf16Char *out;
+    size_t n;
+    int j;
+
+    printf("%-8s %12s %12s %12s\n", "text", "utf8to16", "reference", "memcpy");
+    for (j = 0; j < 3; j++) {
+        text = make_text((size_t)(mb * 1024 * 1024), mixes[j], bases[j], ranges[j], &n);
+        out = (Utf16Char *)malloc((n + 1) * sizeof(Utf16Char));
+        if (!text || !out) {
+            fputs("Out of memory\n", stderr);
+            exit(2);
+        }
+        bench1(utf8to16, text, n, out, 1);   /* fault in the pages */
+        printf("%-8s %7.0f MB/s %7.0f MB/s %7.0f MB/s\n", names[j],
+            bench1(utf8to16, text, n, out, reps), bench1(ref8to16, text, n, out, reps),
+            bench1(NULL, text, n, out, reps));
+        free(text);
+        free(out);
+    }
+    printf("(%s fast path)\n", UTF8TO16_SSE2 ? "SSE2" : "8-byte");
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage:  utf8bench [-s MB] [-n reps] [-P] [-B]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    double mb = 16;
+    int reps = 10, doprops = 1, dobench = 1, j, nfail = 0;
+
+    for (j = 1; j < argc; j++) {
+        if (strcmp(argv[j], "-s") == 0 && j + 1 < argc) mb = atof(argv[++j]);
+        else if (strcmp(argv[j], "-n") == 0 && j + 1 < argc) reps = atoi(argv[++j]);
+        else if (strcmp(argv[j], "-P") == 0) doprops = 0;
+        else if (strcmp(argv[j], "-B") == 0) dobench = 0;
+        else usage();
+    }
+    if (mb <= 0 || reps < 1) usage();
+    if (doprops) nfail = properties();
+    if (dobench) benchmark(mb, reps);
+    return nfail ? 1 : 0;
+}
@@ -0,0 +1,170 @@
+/* utf8to16.h: convert UTF-8 to UTF-16, checking that it is valid UTF-8.
+
+   The conversion is done in one pass.  Runs of ASCII, which is most of
+   any script, are converted 16 bytes at a time with SSE2 (8 at a time
+   without it, or if compiled with -DUTF8TO16_SSE2=0).  Other characters
+   are decoded one at a time, rejecting everything that is not valid UTF-8:
+   stray continuation bytes, overlong forms, surrogates, code points past
+   U+10FFFF, and sequences cut off by the end of the input.  Characters
+   past U+FFFF become surrogate pairs.
+
+   UTF-16 never needs more 16-bit units than UTF-8 needs bytes, so the
+   output buffer can be allocated before converting: n + 1 units for n
+   bytes, including the terminating zero.
+
+   There is no dependency on Windows; on Windows, Utf16Char is WCHAR, so
+   the output can be passed straight to wide-character APIs.
+   All functions are static, so just #include this file.
+ */
+
+#ifndef UTF8TO16_H
+#define UTF8TO16_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef UTF8TO16_SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTF8TO16_SSE2 1
+#else
+#define UTF8TO16_SSE2 0
+#endif
+#endif
+
+#if UTF8TO16_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+static unsigned utf8to16_ctz(unsigned x)
+{
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (unsigned)i;
+}
+#else
+#define utf8to16_ctz(x) ((unsigned)__builtin_ctz(x))
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define UTF8TO16_FUNC static __attribute__((unused))
+#else
+#define UTF8TO16_FUNC static
+#endif
+
+#ifdef _WIN32
+typedef wchar_t Utf16Char;
+#else
+typedef uint16_t Utf16Char;
+#endif
+
+#define UTF8TO16_ERROR ((size_t)-1)
+
+/* Convert UTF-8 to UTF-16.
+ * Entry: src, n: the UTF-8 text, which need not be null-terminated
+ *        dst: room for n + 1 UTF-16 units
+ *        errpos: where to store the offset of the first invalid byte,
+ *          or NULL
+ * Exit:  Returns the number of UTF-16 units, not counting the zero that
+ *          is stored after them; or UTF8TO16_ERROR if src is not valid
+ *          UTF-8, in which case the contents of dst are undefined.
+ */
+UTF8TO16_FUNC size_t utf8to16(const unsigned char *src, size_t n, Utf16Char *dst, size_t *errpos)
+{
+    const unsigned char *p = src, *end = src + n;
+    Utf16Char *q = dst;
+    uint32_t c;
+    unsigned lo, hi;
+    int j, k;
+#if UTF8TO16_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v;
+    unsigned mask;
+#else
+    uint64_t v;
+#endif
+
+    for (;;) {
+        /* Fast path: blocks of ASCII.  A block with a non-ASCII byte
+           is widened anyway, and the ASCII bytes before it are kept;
+           the rest of the output is overwritten by what follows.  This
+           never writes past dst[n], since there are 16 bytes left. */
+#if UTF8TO16_SSE2
+        while (end - p >= 16) {
+            v = _mm_loadu_si128((const __m128i *)p);
+            mask = (unsigned)_mm_movemask_epi8(v);
+            _mm_storeu_si128((__m128i *)q, _mm_unpacklo_epi8(v, zero));
+            _mm_storeu_si128((__m128i *)(q + 8), _mm_unpackhi_epi8(v, zero));
+            if (mask) {
+                k = (int)utf8to16_ctz(mask);
+                p += k;
+                q += k;
+                break;
+            }
+            p += 16;
+            q += 16;
+        }
+#else
+        while (end - p >= 8) {
+            memcpy(&v, p, 8);
+            if (v & 0x8080808080808080ULL) break;
+            for (j = 0; j < 8; j++) q[j] = p[j];
+            p += 8;
+            q += 8;
+        }
+#endif
+        if (p == end) break;
+        if (*p < 0x80) {
+            *q++ = *p++;
+            continue;
+        }
+
+        /* Slow path: a run of non-ASCII characters.  The lead byte gives
+           the length, and the range allowed for the next byte, which
+           rules out overlong forms, surrogates and code points past
+           U+10FFFF. */
+        do {
+            c = *p;
+            if (c < 0xC2 || c > 0xF4) goto bad;
+            if (c < 0xE0) {
+                k = 1;
+                c &= 0x1F;
+                lo = 0x80;
+                hi = 0xBF;
+            } else if (c < 0xF0) {
+                k = 2;
+                lo = c == 0xE0 ? 0xA0 : 0x80;
+                hi = c == 0xED ? 0x9F : 0xBF;
+                c &= 0x0F;
+            } else {
+                k = 3;
+                lo = c == 0xF0 ? 0x90 : 0x80;
+                hi = c == 0xF4 ? 0x8F : 0xBF;
+                c &= 0x07;
+            }
+            if (end - p <= k || p[1] < lo || p[1] > hi) goto bad;
+            c = (c << 6) | (p[1] & 0x3F);
+            for (j = 2; j <= k; j++) {
+                if ((p[j] & 0xC0) != 0x80) goto bad;
+                c = (c << 6) | (p[j] & 0x3F);
+            }
+            p += k + 1;
+            if (c >= 0x10000) {
+                c -= 0x10000;
+                *q++ = (Utf16Char)(0xD800 | (c >> 10));
+                *q++ = (Utf16Char)(0xDC00 | (c & 0x3FF));
+            } else {
+                *q++ = (Utf16Char)c;
+            }
+        } while (p < end && *p >= 0x80);
+    }
+    *q = 0;
+    return (size_t)(q - dst);
+
+bad:
+    if (errpos) *errpos = (size_t)(p - src);
+    return UTF8TO16_ERROR;
+}
+
+#endif /* UTF8TO16_H */
@@ -0,0 +1,184 @@
+/* peobench.c: compare the cold-start time of raw and compressed bundles.
+
+   Usage:  peobench [-n reps] [-s MB] [payload]
+   Builds bundles in the current directory holding the same payload
+   stored as is and compressed, each with and without a checksum (as by
+   peopack, with -z and -c), then times peo_load_payload on each:
+      cold: the bundle is first dropped from the page cache with
+            posix_fadvise(POSIX_FADV_DONTNEED), so it is read from disk;
+      warm: the bundle is already in the page cache.
+   The median of reps runs is reported, along with the bundle sizes, and
+   the speed of the CRC-32C code on the payload in memory.
+   Without a payload file, a synthetic one of MB megabytes (default 32)
+   is generated: script text and a table of numbers, like what we bundle.
+   Each load is checked against the original payload.
+
+   Where posix_fadvise is not available, cold and warm are the same.
+   Build on Linux or macOS:
+      cc -O2 -o peobench peobench.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "peoverlay.h"
+#include "peotestutil.h"
+
+#define STUB_SIZE 65536   /* stands in for the executable image */
+
+/* Write a bundle: a stub, the payload as one entry, and a trailer.
+ * Exit:  Returns the size of the bundle, or 0 if an error occurs.
+ */
+uint64_t make_bundle(const char *path, const char *payloadpath, uint32_t flags)
+{
+    static unsigned char stub[STUB_SIZE];
+    PeoEntry entry;
+    FILE *out, *in;
+    int err;
+
+    out = fopen(path, "wb");
+    in = fopen(payloadpath, "rb");
+    if (!out || !in) {
+        fprintf(stderr, "Error opening %s or %s\n", path, payloadpath);
+        exit(2);
+    }
+    memset(&entry, 0, sizeof(entry));
+    strcpy(entry.name, "main");
+    entry.offset = STUB_SIZE + PEO_START_SIZE;
+    entry.flags = flags;
+    err = fwrite(stub, 1, STUB_SIZE, out) == STUB_SIZE ? PEO_OK : PEO_ERR_WRITE;
+    if (err == PEO_OK) err = peo_write_start(out);
+    if (err == PEO_OK) err = peo_write_entry(out, in, &entry);
+    if (err == PEO_OK) err = peo_write_trailer(out, entry.offset + entry.length, &entry, 1);
+    fclose(in);
+    /* Dirty pages cannot be dropped from the cache, so flush them. */
+    if (fflush(out) != 0 || fsync(fileno(out)) != 0) err = PEO_ERR_WRITE;
+    if (fclose(out) != 0) err = PEO_ERR_WRITE;
+    if (err != PEO_OK) {
+        fprintf(stderr, "Error writing %s: %s\n", path, peo_strerror(err));
+        exit(2);
+    }
+    return entry.offset + entry.length + PEO_ENTRY_SIZE + PEO_FOOTER_SIZE;
+}
+
+/* Drop a file from the page cache. */
+void drop_cache(const char *path)
+{
+#ifdef POSIX_FADV_DONTNEED
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#else
+    (void)path;
+#endif
+}
+
+int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Load the payload from a bundle reps times.
+ * Exit:  Returns the median time in seconds.
+ */
+double time_load(const char *path, int cold, int reps, const unsigned char *expect, size_t expectsize)
+{
+    double *times = (double *)malloc(reps * sizeof(double));
+    double t0, median;
+    unsigned char *buf;
+    size_t size;
+    int err, rep;
+
+    for (rep = 0; rep < reps; rep++) {
+        if (cold) drop_cache(path);
+        t0 = now();
+        buf = peo_load_payload(path, NULL, &size, &err);
+        times[rep] = now() - t0;
+        if (!buf) {
+            fprintf(stderr, "Error loading %s: %s\n", path, peo_strerror(err));
+            exit(3);
+        }
+        if (size != expectsize || memcmp(buf, expect, size) != 0) {
+            fprintf(stderr, "Payload loaded from %s differs from the original\n", path);
+            exit(3);
+        }
+        free(buf);
+    }
+    qsort(times, reps, sizeof(double), cmp_double);
+    median = times[reps / 2];
+    free(times);
+    return median;
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage:  peobench [-n reps] [-s MB] [payload]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *names[4] = { "raw", "raw+crc", "compressed", "compr+crc" };
+    const char *paths[4] = { "peobench.raw", "peobench.rawc", "peobench.lz", "peobench.lzc" };
+    const uint32_t flags[4] = { 0, PEO_F_CRC, PEO_F_LZ, PEO_F_LZ | PEO_F_CRC };
+    const char *payloadpath = NULL;
+    unsigned char *payload;
+    size_t size;
+    uint64_t bundlesize;
+    uint32_t crc = 0;
+    double mb = 32, cold, warm, mbsize, t0;
+    int reps = 5, j;
+
+    for (j = 1; j < argc; j++) {
+        if (strcmp(argv[j], "-n") == 0 && j + 1 < argc) {
+            reps = atoi(argv[++j]);
+        } else if (strcmp(argv[j], "-s") == 0 && j + 1 < argc) {
+            mb = atof(argv[++j]);
+        } else if (argv[j][0] == '-' || payloadpath) {
+            usage();
+        } else {
+            payloadpath = argv[j];
+        }
+    }
+    if (reps < 1 || mb <= 0) usage();
+
+    if (payloadpath) {
+        payload = readfile(payloadpath, &size);
+    } else {
+        size = (size_t)(mb * 1024 * 1024);
+        payload = make_payload(size, 0);
+        payloadpath = "peobench.dat";
+        writefile(payloadpath, payload, size);
+    }
+
+#ifndef POSIX_FADV_DONTNEED
+    printf("posix_fadvise is not available: cold runs will be warm\n");
+#endif
+    mbsize = size / (1024.0 * 1024.0);
+    printf("Payload: %.1f MB, %d runs each, median times\n", mbsize, reps);
+    printf("%-11s %12s %7s %10s %10s %10s\n", "bundle", "bytes", "ratio",
+        "cold ms", "warm ms", "warm MB/s");
+    for (j = 0; j < 4; j++) {
+        bundlesize = make_bundle(paths[j], payloadpath, flags[j]);
+        cold = time_load(paths[j], 1, reps, payload, size);
+        warm = time_load(paths[j], 0, reps, payload, size);
+        printf("%-11s %12llu %6.1f%% %10.2f %10.2f %10.1f\n", names[j],
+            (unsigned long long)bundlesize, 100.0 * bundlesize / (size + STUB_SIZE),
+            cold * 1000, warm * 1000, mbsize / warm);
+        remove(paths[j]);
+    }
+
+    t0 = now();
+    for (j = 0; j < reps; j++) crc ^= peocrc32c(0, payload, size);
+    printf("CRC-32C (%s): %.0f MB/s, crc %08lx\n", peocrc_method(),
+        mbsize * reps / (now() - t0), (unsigned long)crc);
+    if (strcmp(payloadpath, "peobench.dat") == 0) remove(payloadpath);
+    free(payload);
+    return 0;
+}
@@ -0,0 +1,194 @@
+/* peolz.h: a small, fast LZ77 compressor and decompressor for payloads.
+
+   The compressed format is the LZ4 block format, so the decompressor is
+   a tight loop of byte copies and is limited mainly by memory bandwidth.
+   The compressor is a simple greedy one with a 4096-entry hash table; it
+   is fast, and does well on scripts and text tables, which is what we
+   bundle.  Blocks are independent, so data can be decompressed piece by
+   piece as it is read.
+
+   Each sequence is: a token byte (high 4 bits literal count, low 4 bits
+   match length - 4, 15 meaning more length bytes follow), the literals,
+   a 2-byte little-endian match offset, and any extra match length bytes.
+   The last sequence has literals only.
+
+   All functions are static, so just #include this file.
+ */
+
+#ifndef PEOLZ_H
+#define PEOLZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__)
+#define PEOLZ_FUNC static __attribute__((unused))
+#else
+#define PEOLZ_FUNC static
+#endif
+
+#define PEOLZ_HASHLOG   12
+#define PEOLZ_MINMATCH  4
+#define PEOLZ_MFLIMIT   12   /* no match may start in the last 12 bytes */
+#define PEOLZ_LASTLITS  5    /* the last 5 bytes are always literals */
+#define PEOLZ_MAXOFFSET 65535
+
+/* Largest possible compressed size for n bytes of input. */
+#define PEOLZ_BOUND(n)  ((n) + (n)/255 + 16)
+
+/* No compressed data decompresses to more than this many times its size:
+   a sequence of k + 3 bytes gives a match of at most 19 + 255k bytes. */
+#define PEOLZ_MAXRATIO  255
+
+PEOLZ_FUNC uint32_t peolz_read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+PEOLZ_FUNC uint32_t peolz_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - PEOLZ_HASHLOG);
+}
+
+/* Write a length of 15 or more as a run of 255s and a final byte. */
+PEOLZ_FUNC unsigned char *peolz_putlen(unsigned char *op, size_t len)
+{
+    for (; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+PEOLZ_FUNC unsigned char *peolz_sequence(unsigned char *op, const unsigned char *lits,
+    size_t nlits, size_t offset, size_t matchlen)
+{
+    unsigned char *token = op++;
+    size_t ml = matchlen ? matchlen - PEOLZ_MINMATCH : 0;
+
+    *token = (unsigned char)(((nlits < 15 ? nlits : 15) << 4) | (ml < 15 ? ml : 15));
+    if (nlits >= 15) op = peolz_putlen(op, nlits - 15);
+    memcpy(op, lits, nlits);
+    op += nlits;
+    if (matchlen) {
+        *op++ = (unsigned char)offset;
+        *op++ = (unsigned char)(offset >> 8);
+        if (ml >= 15) op = peolz_putlen(op, ml - 15);
+    }
+    return op;
+}
+
+/* Compress a block.
+ * Entry: src, n: data to compress
+ *        dst: buffer of at least PEOLZ_BOUND(n) bytes
+ * Exit:  Returns the compressed size.
+ */
+PEOLZ_FUNC size_t peolz_compress(const unsigned char *src, size_t n, unsigned char *dst)
+{
+    uint32_t table[1 << PEOLZ_HASHLOG];   /* position + 1, or 0 if none */
+    size_t ip = 0, anchor = 0, ref, ml;
+    uint32_t seq, h;
+    unsigned char *op = dst;
+
+    memset(table, 0, sizeof(table));
+    if (n > PEOLZ_MFLIMIT) {
+        while (ip < n - PEOLZ_MFLIMIT) {
+            seq = peolz_read32(src + ip);
+            h = peolz_hash(seq);
+            ref = table[h];
+            table[h] = (uint32_t)(ip + 1);
+            if (ref-- && ip - ref <= PEOLZ_MAXOFFSET && peolz_read32(src + ref) == seq) {
+                ml = PEOLZ_MINMATCH;
+                while (ip + ml < n - PEOLZ_LASTLITS && src[ref + ml] == src[ip + ml]) ml++;
+                op = peolz_sequence(op, src + anchor, ip - anchor, ip - ref, ml);
+                ip += ml;
+                anchor = ip;
+            } else {
+                ip++;
+            }
+        }
+    }
+    op = peolz_sequence(op, src + anchor, n - anchor, 0, 0);
+    return (size_t)(op - dst);
+}
+
+/* Copy 8 bytes at a time while op < end; may write up to 7 bytes past end. */
+PEOLZ_FUNC void peolz_wildcopy(unsigned char *op, const unsigned char *ip, unsigned char *end)
+{
+    do {
+        memcpy(op, ip, 8);
+        op += 8;
+        ip += 8;
+    } while (op < end);
+}
+
+/* Decompress a block, checking every length and offset against the
+ * buffers, so damaged data cannot cause reads or writes outside them.
+ * Away from the ends of the buffers, copies are done 8 or 16 bytes at a
+ * time, overrunning into space that later copies overwrite.
+ * Entry: src, n: compressed data
+ *        dst, cap: output buffer and its size
+ * Exit:  Returns the decompressed size, or -1 if the data is invalid.
+ */
+PEOLZ_FUNC long peolz_decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap)
+{
+    const unsigned char *ip = src, *iend = src + n;
+    unsigned char *op = dst, *oend = dst + cap;
+    const unsigned char *match;
+    size_t len, offset;
+    unsigned b, token;
+
+    while (ip < iend) {
+        token = *ip++;
+
+        len = token >> 4;
+        if (len < 15 && iend - ip >= 16 + 2 && oend - op >= 16) {
+            /* Common case: a short run of literals, copied in one go. */
+            memcpy(op, ip, 16);
+        } else {
+            if (len == 15) {
+                do {
+                    if (ip >= iend) return -1;
+                    b = *ip++;
+                    len += b;
+                } while (b == 255);
+            }
+            if (len > (size_t)(iend - ip) || len > (size_t)(oend - op)) return -1;
+            if (iend - ip >= (long)len + 8 && oend - op >= (long)len + 8) {
+                peolz_wildcopy(op, ip, op + len);
+            } else {
+                memcpy(op, ip, len);
+            }
+        }
+        op += len;
+        ip += len;
+        if (ip == iend) break;         /* last sequence: literals only */
+
+        if (iend - ip < 2) return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) return -1;
+        len = (token & 15) + PEOLZ_MINMATCH;
+        if ((token & 15) == 15) {
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        if (len > (size_t)(oend - op)) return -1;
+        match = op - offset;
+        if (offset >= 8 && oend - op >= (long)len + 8) {
+            peolz_wildcopy(op, match, op + len);
+            op += len;
+        } else {
+            /* Overlapping match, or near the end: copy byte by byte,
+               which also repeats a short pattern. */
+            while (len--) *op++ = *match++;
+        }
+    }
+    return (long)(op - dst);
+}
+
+#endif /* PEOLZ_H */
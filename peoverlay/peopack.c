@@ -0,0 +1,149 @@
+/* peopack.c: build an executable from a stub and one or more payloads.
+   The output is a copy of the stub, followed by each payload file and a
+   trailer that indexes them by name (see peoverlay.h).  The first payload
+   is the main one: the script that jsstub runs, or the program that basic
+   loads.  Other payloads (modules, data) can be opened by name.
+
+   Usage:  peopack [-z] [-c] stub.exe out.exe [name=]file ...
+   The name of each payload is the file's name, unless given explicitly.
+   -z compresses the payloads; they are decompressed when loaded.
+   -c stores a checksum of each payload, which is checked when it is
+      loaded, so that a truncated or damaged executable is not run.
+   Example:
+      cc -o peopack peopack.c
+      peopack -z -c jsstub.exe dirlist.exe main.js=dirlist.js helpers.js
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peoverlay.h"
+
+/* Append the contents of a file to out.
+ * Exit:  Returns the number of bytes copied, or -1 if an error occurs.
+ */
+long long copy_file(const char *path, FILE *out)
+{
+    static unsigned char buf[65536];
+    FILE *in;
+    size_t n;
+    long long total = 0;
+
+    in = fopen(path, "rb");
+    if (!in) {
+        fprintf(stderr, "Error opening %s\n", path);
+        return -1;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) {
+            fprintf(stderr, "Error writing output\n");
+            fclose(in);
+            return -1;
+        }
+        total += n;
+    }
+    if (ferror(in)) {
+        fprintf(stderr, "Error reading %s\n", path);
+        total = -1;
+    }
+    fclose(in);
+    return total;
+}
+
+/* Return the last component of a path. */
+const char *base_name(const char *path)
+{
+    const char *s, *base = path;
+    for (s = path; *s; s++) {
+        if (*s == '/' || *s == '\\' || *s == ':') base = s + 1;
+    }
+    return base;
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage:  peopack [-z] [-c] stub.exe out.exe [name=]file ...\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    static PeoEntry entries[PEO_MAX_ENTRIES];
+    const char *outpath, *path, *eq, *name;
+    FILE *out, *in;
+    long long n;
+    uint64_t pos;
+    uint32_t flags = 0;
+    int nentries = 0, j, k, err = 0;
+
+    while (argc > 1 && argv[1][0] == '-') {
+        if (strcmp(argv[1], "-z") == 0) flags |= PEO_F_LZ;
+        else if (strcmp(argv[1], "-c") == 0) flags |= PEO_F_CRC;
+        else usage();
+        argc--;
+        argv++;
+    }
+    if (argc < 4) usage();
+    if (argc - 3 > PEO_MAX_ENTRIES) {
+        fprintf(stderr, "Too many payloads; the limit is %d\n", PEO_MAX_ENTRIES);
+        return 2;
+    }
+    outpath = argv[2];
+    out = fopen(outpath, "wb");
+    if (!out) {
+        fprintf(stderr, "Error creating %s\n", outpath);
+        return 2;
+    }
+
+    n = copy_file(argv[1], out);
+    if (n < 0 || peo_write_start(out) != PEO_OK) err = 1;
+    pos = (uint64_t)n + PEO_START_SIZE;
+
+    for (j = 3; j < argc && !err; j++) {
+        eq = strchr(argv[j], '=');
+        path = eq ? eq + 1 : argv[j];
+        name = eq ? argv[j] : base_name(path);
+        k = eq ? (int)(eq - argv[j]) : (int)strlen(name);
+        if (k < 1 || k > PEO_NAME_MAX) {
+            fprintf(stderr, "Payload name must be 1 to %d characters: %s\n", PEO_NAME_MAX, argv[j]);
+            err = 1;
+            break;
+        }
+        memset(&entries[nentries], 0, sizeof(PeoEntry));
+        memcpy(entries[nentries].name, name, k);
+        for (k = 0; k < nentries; k++) {
+            if (strcmp(entries[k].name, entries[nentries].name) == 0) {
+                fprintf(stderr, "Duplicate payload name %s\n", entries[k].name);
+                err = 1;
+            }
+        }
+        in = fopen(path, "rb");
+        if (!in) {
+            fprintf(stderr, "Error opening %s\n", path);
+            err = 1;
+            break;
+        }
+        entries[nentries].flags = flags;
+        k = peo_write_entry(out, in, &entries[nentries]);
+        fclose(in);
+        if (k != PEO_OK) {
+            fprintf(stderr, "Error packing %s: %s\n", path, peo_strerror(k));
+            err = 1;
+        }
+        entries[nentries].offset = pos;
+        pos += entries[nentries].length;
+        nentries++;
+    }
+
+    if (!err && peo_write_trailer(out, pos, entries, nentries) != PEO_OK) {
+        fprintf(stderr, "Error writing %s\n", outpath);
+        err = 1;
+    }
+    if (fclose(out) != 0) err = 1;
+    if (err) {
+        remove(outpath);
+        return 3;
+    }
+    return 0;
+}
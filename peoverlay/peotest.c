@@ -0,0 +1,504 @@
+/* peotest.c: tests for peoverlay.h, peolz.h and the payload trailer.
+   Build and run on Linux or macOS, in this directory:
+      cc -O2 -o peotest peotest.c
+      ./peotest [-d fixtures]
+
+   1. Locates the end of the image in each of the PE fixtures in testdata
+      (see testdata/mkfixtures.py): PE32 and PE32+, stripped and not,
+      UPX-packed, and truncated.  Each is read both with pread and from
+      memory, and the results are checked against the table below.
+      Loading a payload from each, from a missing file and from this
+      program must find none, rather than report damage.
+   2. Appends 100 MB (a sparse file) to each good fixture and checks that
+      locating it still reads only a few hundred bytes.
+   3. Cuts each good fixture at every length, and damages its headers
+      at random, checking that nothing beyond the file is ever claimed.
+   4. Loads a bare overlay, as made by copy /b.
+   5. Builds bundles with a trailer, with payloads of many sizes stored
+      as is, compressed, and with and without a checksum, and loads each
+      one back by name, whole and a block at a time.  Then damages and
+      truncates them, checking that damage is reported rather than
+      returned as data.
+   6. Round-trips the LZ codec on assorted data, and feeds the
+      decompressor damaged and truncated input.
+   7. Checks that peo_open rejects what is not a regular file.
+   8. Checks CRC-32C against the known value for "123456789", and the
+      SSE4.2 version against the table version, at every alignment and
+      at lengths around the block sizes of the SSE4.2 version.
+   Run it under -fsanitize=address,undefined to check memory safety too.
+   It writes temporary files named peotest.* in the current directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "peoverlay.h"
+#include "peotestutil.h"
+
+#define TMPFILE "peotest.tmp"
+
+int nchecks, nfailed;
+
+void check(int ok, const char *what, const char *detail)
+{
+    nchecks++;
+    if (!ok) {
+        nfailed++;
+        if (nfailed <= 30) printf("FAILED: %s (%s)\n", what, detail);
+    }
+}
+
+/* The fixtures, and what peo_locate should make of them. */
+typedef struct {
+    const char *file;
+    int         err;
+    uint64_t    imageend;
+    uint16_t    machine;
+    int         stripped;
+    int         nsections;
+} Fixture;
+
+const Fixture fixtures[] = {
+    { "pe32.exe",    PEO_OK,           0xC00, 0x14C,  1, 3 },
+    { "pe64.exe",    PEO_OK,           0xE00, 0x8664, 1, 4 },
+    { "pe32sym.exe", PEO_OK,           0xA00, 0x14C,  0, 2 },
+    { "pe64sym.exe", PEO_OK,           0xC00, 0x8664, 0, 2 },
+    { "upx.exe",     PEO_OK,           0xC00, 0x14C,  1, 3 },
+    { "upxsym.exe",  PEO_ERR_UPX,      0,     0,      0, 0 },
+    { "trunc.exe",   PEO_ERR_SECTIONS, 0,     0,      0, 0 },
+};
+#define NFIXTURES ((int)(sizeof(fixtures)/sizeof(fixtures[0])))
+
+const char *fixdir = "testdata";
+
+/* A PeoReadFn that counts what it reads. */
+typedef struct {
+    PeoFile  *pf;
+    int       reads;
+    uint64_t  bytes;
+} Counter;
+
+int count_read(void *ctx, uint64_t offset, void *buf, size_t len)
+{
+    Counter *c = (Counter *)ctx;
+    c->reads++;
+    c->bytes += len;
+    return peo_read(c->pf, offset, buf, len);
+}
+
+void test_fixtures(void)
+{
+    char path[1024], detail[1200];
+    const Fixture *fx;
+    unsigned char *img, *cut;
+    size_t size, len;
+    PeoFile pf;
+    PeoInfo info, minfo;
+    Counter ctr;
+    int j, k, err, merr, lerr;
+
+    /* Nor is a file that is not there, or that is not a PE file */
+    cut = peo_load_payload("peotest.none", NULL, &len, &lerr);
+    check(!cut && !peo_payload_damaged(lerr), "missing file", peo_strerror(lerr));
+    if (peo_selfpath()) {
+        cut = peo_load_payload(peo_selfpath(), NULL, &len, &lerr);
+        check(!cut && !peo_payload_damaged(lerr), "not a PE file", peo_strerror(lerr));
+    }
+
+    for (j = 0; j < NFIXTURES; j++) {
+        fx = &fixtures[j];
+        sprintf(path, "%s/%s", fixdir, fx->file);
+        img = readfile(path, &size);
+
+        /* 1. From the file and from memory */
+        if (peo_open(&pf, path) != PEO_OK) exit(2);
+        err = peo_locate_file(&pf, &info);
+        peo_close(&pf);
+        merr = peo_locate_mem(img, size, &minfo);
+        sprintf(detail, "%s: error %d, image end 0x%llx", fx->file, err,
+            (unsigned long long)info.imageend);
+        check(err == fx->err, "error code", detail);
+        check(merr == err, "same error from memory", detail);
+        /* No payload, or a file that cannot be examined, is not damage */
+        cut = peo_load_payload(path, NULL, &len, &lerr);
+        check(cut ? len == 0 : !peo_payload_damaged(lerr), "no payload", detail);
+        free(cut);
+        if (fx->err == PEO_OK && err == PEO_OK) {
+            check(info.imageend == fx->imageend, "image end", detail);
+            check(info.machine == fx->machine, "machine", detail);
+            check(info.stripped == fx->stripped, "stripped", detail);
+            check(info.nsections == fx->nsections, "section count", detail);
+            check(minfo.imageend == info.imageend, "same image end from memory", detail);
+        }
+        if (fx->err != PEO_OK || err != PEO_OK) {
+            free(img);
+            continue;
+        }
+
+        /* 2. 100 MB appended costs only the headers */
+        writefile(TMPFILE, img, size);
+        if (truncate(TMPFILE, (off_t)size + 100 * 1024 * 1024) != 0 ||
+            peo_open(&pf, TMPFILE) != PEO_OK) {
+            fprintf(stderr, "Error extending %s\n", TMPFILE);
+            exit(2);
+        }
+        ctr.pf = &pf;
+        ctr.reads = 0;
+        ctr.bytes = 0;
+        err = peo_locate(count_read, &ctr, pf.size, &info);
+        peo_close(&pf);
+        remove(TMPFILE);
+        sprintf(detail, "%s: %d reads, %llu bytes", fx->file, ctr.reads,
+            (unsigned long long)ctr.bytes);
+        check(err == PEO_OK && info.imageend == fx->imageend, "locate with 100 MB appended", detail);
+        check(ctr.reads <= 4 && ctr.bytes <= 4096, "locate reads only headers", detail);
+
+        /* 3. Cut short at every length, and damaged headers */
+        cut = (unsigned char *)malloc(size);
+        for (len = 0; len < size; len++) {
+            memcpy(cut, img, len);
+            err = peo_locate_mem(cut, len, &info);
+            sprintf(detail, "%s cut to %lu bytes: error %d", fx->file, (unsigned long)len, err);
+            if (len < fx->imageend) check(err != PEO_OK, "truncated image rejected", detail);
+            else check(err == PEO_OK && info.imageend == fx->imageend, "cut after image", detail);
+        }
+        for (k = 0; k < 20000; k++) {
+            memcpy(cut, img, size);
+            cut[rnd(0x80 + 24 + 240 + 40 * fx->nsections)] = (unsigned char)rnd(256);
+            if (rnd(2)) cut[rnd(0x200)] = (unsigned char)rnd(256);
+            err = peo_locate_mem(cut, size, &info);
+            if (err == PEO_OK) {
+                sprintf(detail, "%s damaged: image end 0x%llx", fx->file,
+                    (unsigned long long)info.imageend);
+                check(info.imageend <= size, "damaged image stays within file", detail);
+            }
+        }
+        free(cut);
+        free(img);
+    }
+}
+
+/* Where test_entry's sink puts the data */
+typedef struct {
+    unsigned char *buf;
+    size_t size, pos;
+    int calls;
+} Collect;
+
+int collect(void *ctx, const unsigned char *buf, size_t len)
+{
+    Collect *c = (Collect *)ctx;
+    c->calls++;
+    if (len > PEO_BLOCK_SIZE || len > c->size - c->pos) return PEO_ERR_DATA;
+    memcpy(c->buf + c->pos, buf, len);
+    c->pos += len;
+    return PEO_OK;
+}
+
+const size_t sizes[] = { 0, 1, 5, 13, 100, 65535, 65536, 65537, 200000, 1000000 };
+#define NSIZES ((int)(sizeof(sizes)/sizeof(sizes[0])))
+const uint32_t flagsets[] = { 0, PEO_F_CRC, PEO_F_LZ, PEO_F_LZ | PEO_F_CRC };
+#define NFLAGSETS 4
+
+/* Build a bundle of the stub and one entry for each size and flag set.
+ * Exit:  Returns the size of the bundle, and fills in entries.
+ */
+uint64_t make_bundle(const char *path, const unsigned char *stub, size_t stubsize,
+    unsigned char **payloads, PeoEntry *entries)
+{
+    FILE *out, *in;
+    uint64_t pos = stubsize + PEO_START_SIZE;
+    int j, k, n = 0, err = PEO_OK;
+
+    out = fopen(path, "wb");
+    if (!out || fwrite(stub, 1, stubsize, out) != stubsize) exit(2);
+    err = peo_write_start(out);
+    for (j = 0; j < NSIZES; j++) {
+        for (k = 0; k < NFLAGSETS; k++, n++) {
+            writefile("peotest.in", payloads[j], sizes[j]);
+            in = fopen("peotest.in", "rb");
+            if (!in) exit(2);
+            memset(&entries[n], 0, sizeof(PeoEntry));
+            sprintf(entries[n].name, "p%lu.%u", (unsigned long)sizes[j], (unsigned)flagsets[k]);
+            entries[n].offset = pos;
+            entries[n].flags = flagsets[k];
+            if (err == PEO_OK) err = peo_write_entry(out, in, &entries[n]);
+            pos += entries[n].length;
+            fclose(in);
+        }
+    }
+    remove("peotest.in");
+    if (err == PEO_OK) err = peo_write_trailer(out, pos, entries, n);
+    if (fclose(out) != 0 || err != PEO_OK) {
+        fprintf(stderr, "Error writing %s: %s\n", path, peo_strerror(err));
+        exit(2);
+    }
+    return pos + (uint64_t)n * PEO_ENTRY_SIZE + PEO_FOOTER_SIZE;
+}
+
+void test_bundles(void)
+{
+    char path[1024], detail[256];
+    unsigned char *stub, *bare, *buf, *bundle, *payloads[NSIZES];
+    size_t stubsize, size, bsize, cut;
+    PeoEntry entries[NSIZES * NFLAGSETS];
+    PeoTrailer tr;
+    PeoFile pf;
+    Collect c;
+    uint64_t total;
+    int j, k, n, err;
+
+    sprintf(path, "%s/pe32.exe", fixdir);
+    stub = readfile(path, &stubsize);
+    for (j = 0; j < NSIZES; j++) payloads[j] = make_payload(sizes[j], 1);
+
+    /* 4. A bare overlay: everything after the image */
+    bare = (unsigned char *)malloc(stubsize + 200000);
+    memcpy(bare, stub, stubsize);
+    memcpy(bare + stubsize, payloads[8], 200000);
+    writefile(TMPFILE, bare, stubsize + 200000);
+    buf = peo_load_payload(TMPFILE, NULL, &size, &err);
+    check(buf && size == 200000 && memcmp(buf, payloads[8], size) == 0 && buf[size] == 0,
+        "bare overlay", peo_strerror(err));
+    free(buf);
+    buf = peo_load_payload(TMPFILE, "main", &size, &err);
+    check(!buf && err == PEO_ERR_NOENTRY, "named payload in bare overlay", peo_strerror(err));
+    free(buf);
+    free(bare);
+
+    /* 5. Every entry loads back as it was */
+    total = make_bundle(TMPFILE, stub, stubsize, payloads, entries);
+    if (peo_open(&pf, TMPFILE) != PEO_OK) exit(2);
+    check(pf.size == total, "bundle size", TMPFILE);
+    err = peo_read_trailer_file(&pf, &tr);
+    check(err == PEO_OK && tr.nentries == NSIZES * NFLAGSETS, "read trailer", peo_strerror(err));
+    for (n = 0; n < tr.nentries; n++) {
+        const PeoEntry *e = &tr.entries[n];
+        j = n / NFLAGSETS;
+        sprintf(detail, "%s", e->name);
+        check(strcmp(e->name, entries[n].name) == 0 && e->offset == entries[n].offset &&
+            e->length == entries[n].length && e->flags == entries[n].flags &&
+            e->crc == entries[n].crc, "index entry", detail);
+        check((e->flags & PEO_F_CRC) || e->crc == 0, "crc stored only with PEO_F_CRC", detail);
+        check(peo_find_entry(&tr, e->name) == e, "find entry", detail);
+        check(peo_entry_size(peo_read, &pf, e, &total) == PEO_OK && total == sizes[j],
+            "entry size", detail);
+
+        buf = peo_load_payload(TMPFILE, e->name, &size, &err);
+        check(buf && size == sizes[j] && memcmp(buf, payloads[j], size) == 0 && buf[size] == 0,
+            "load payload", detail);
+        free(buf);
+
+        c.size = sizes[j];
+        c.buf = (unsigned char *)malloc(c.size + 1);
+        c.pos = 0;
+        c.calls = 0;
+        err = peo_read_entry(peo_read, &pf, e, collect, &c);
+        check(err == PEO_OK && c.pos == c.size && memcmp(c.buf, payloads[j], c.size) == 0,
+            "read entry block by block", detail);
+        check(c.calls == (int)((sizes[j] + PEO_BLOCK_SIZE - 1) / PEO_BLOCK_SIZE),
+            "one call per block", detail);
+        free(c.buf);
+    }
+    check(peo_find_entry(&tr, NULL) == &tr.entries[0], "main entry is the first", TMPFILE);
+    check(peo_find_entry(&tr, "nope") == NULL, "no such entry", TMPFILE);
+    buf = peo_load_payload(TMPFILE, NULL, &size, &err);
+    check(buf && size == 0, "load main payload", peo_strerror(err));
+    free(buf);
+    buf = peo_load_payload(TMPFILE, "nope", &size, &err);
+    check(!buf && err == PEO_ERR_NOENTRY, "load missing payload", peo_strerror(err));
+    peo_close(&pf);
+
+    /* Damage each entry of 100 bytes or more in a few places.  Anything
+       with a checksum must be caught; compressed data without one must
+       at least not be read out of bounds. */
+    bundle = readfile(TMPFILE, &bsize);
+    for (n = 0; n < tr.nentries; n++) {
+        const PeoEntry *e = &tr.entries[n];
+        if (sizes[n / NFLAGSETS] < 100) continue;
+        for (k = 0; k < 8; k++) {
+            size_t at = (size_t)(e->offset + rnd((unsigned long)e->length));
+            unsigned char was = bundle[at];
+            bundle[at] ^= (unsigned char)(1 + rnd(255));
+            writefile(TMPFILE, bundle, bsize);
+            bundle[at] = was;
+            buf = peo_load_payload(TMPFILE, e->name, &size, &err);
+            sprintf(detail, "%s, byte %lu: %s", e->name, (unsigned long)(at - e->offset),
+                peo_strerror(err));
+            if (e->flags & PEO_F_CRC) {
+                check(!buf && (err == PEO_ERR_CHECKSUM || err == PEO_ERR_DATA),
+                    "damaged payload rejected", detail);
+            } else if (e->flags & PEO_F_LZ) {
+                check(buf || err == PEO_ERR_DATA || err == PEO_ERR_NOMEM,
+                    "damaged stream loads or is rejected", detail);
+            } else {
+                check(buf != NULL, "unchecked payload loads", detail);
+            }
+            free(buf);
+        }
+    }
+
+    /* Damaged footers and index entries */
+    {
+        static const struct { size_t back; unsigned char byte; const char *what; } hits[] = {
+            { PEO_FOOTER_SIZE - 8,  2,    "trailer version" },
+            { PEO_FOOTER_SIZE - 13, 1,    "entry count" },
+            { PEO_FOOTER_SIZE - 16, 0x40, "index offset" },
+            { PEO_FOOTER_SIZE + PEO_ENTRY_SIZE - 47, 0x7F, "entry offset" },
+            { PEO_FOOTER_SIZE + PEO_ENTRY_SIZE - 55, 0x7F, "entry length" },
+        };
+        for (k = 0; k < (int)(sizeof(hits)/sizeof(hits[0])); k++) {
+            size_t at = bsize - hits[k].back;
+            unsigned char was = bundle[at];
+            bundle[at] ^= hits[k].byte;
+            writefile(TMPFILE, bundle, bsize);
+            bundle[at] = was;
+            buf = peo_load_payload(TMPFILE, NULL, &size, &err);
+            check(!buf && err == PEO_ERR_TRAILER, hits[k].what, peo_strerror(err));
+            free(buf);
+        }
+    }
+
+    /* Cut off at the end: the trailer is gone, but the start marker says
+       this was a bundle, so it must not be loaded as a bare overlay. */
+    for (cut = stubsize + PEO_START_SIZE; cut < bsize; cut += 1 + rnd(bsize / 50)) {
+        writefile(TMPFILE, bundle, cut);
+        buf = peo_load_payload(TMPFILE, NULL, &size, &err);
+        sprintf(detail, "cut to %lu of %lu bytes: %s", (unsigned long)cut,
+            (unsigned long)bsize, peo_strerror(err));
+        check(!buf && err == PEO_ERR_TRAILER, "truncated bundle rejected", detail);
+        free(buf);
+    }
+    free(bundle);
+    remove(TMPFILE);
+    for (j = 0; j < NSIZES; j++) free(payloads[j]);
+    free(stub);
+}
+
+void test_lz(void)
+{
+    static const size_t lens[] = { 0, 1, 4, 12, 13, 16, 64, 1000, 4096, 65536 };
+    unsigned char *src, *z, *out;
+    char detail[64];
+    size_t zlen, n, cut;
+    long got;
+    int j, kind, k;
+
+    src = (unsigned char *)malloc(PEO_BLOCK_SIZE);
+    z = (unsigned char *)malloc(PEOLZ_BOUND(PEO_BLOCK_SIZE));
+    out = (unsigned char *)malloc(PEO_BLOCK_SIZE);
+    for (j = 0; j < (int)(sizeof(lens)/sizeof(lens[0])); j++) {
+        n = lens[j];
+        for (kind = 0; kind < 4; kind++) {
+            /* zeros, random, a short repeated pattern, text */
+            for (k = 0; k < (int)n; k++) {
+                src[k] = kind == 0 ? 0 : kind == 1 ? (unsigned char)rnd(256) :
+                    kind == 2 ? (unsigned char)"abc"[k % 3] : (unsigned char)" etaoin\n"[rnd(8)];
+            }
+            sprintf(detail, "%lu bytes, kind %d", (unsigned long)n, kind);
+            zlen = peolz_compress(src, n, z);
+            check(zlen <= PEOLZ_BOUND(n), "compressed size within bound", detail);
+            got = peolz_decompress(z, zlen, out, n);
+            check(got == (long)n && memcmp(out, src, n) == 0, "round trip", detail);
+            if (n) {
+                got = peolz_decompress(z, zlen, out, n - 1);
+                check(got < 0, "output larger than room rejected", detail);
+            }
+            /* Cut short, or damaged: must never read or write out of
+               bounds (that is for the sanitizers to see), and a cut
+               stream must not decompress to all of the data. */
+            for (cut = 0; cut < zlen; cut += 1 + zlen / 64) {
+                got = peolz_decompress(z, cut, out, n);
+                check(got != (long)n || memcmp(out, src, n) != 0 || n == 0,
+                    "cut stream not taken as whole", detail);
+            }
+            for (k = 0; k < 200 && zlen; k++) {
+                unsigned char was;
+                size_t at = rnd((unsigned long)zlen);
+                was = z[at];
+                z[at] ^= (unsigned char)(1 + rnd(255));
+                got = peolz_decompress(z, zlen, out, n);
+                check(got <= (long)n, "damaged stream stays within room", detail);
+                z[at] = was;
+            }
+        }
+    }
+    free(src);
+    free(z);
+    free(out);
+}
+
+void test_open(void)
+{
+    PeoFile pf;
+
+    check(peo_open(&pf, fixdir) == PEO_ERR_OPEN, "directory rejected", fixdir);
+    check(peo_open(&pf, "peotest.none") == PEO_ERR_OPEN, "missing file rejected", "peotest.none");
+    remove("peotest.fifo");
+    if (mkfifo("peotest.fifo", 0600) == 0) {
+        /* This would hang if peo_open waited for a writer. */
+        check(peo_open(&pf, "peotest.fifo") == PEO_ERR_OPEN, "FIFO rejected", "peotest.fifo");
+        remove("peotest.fifo");
+    }
+}
+
+void test_crc(void)
+{
+    static const size_t lens[] = {
+        0, 1, 7, 8, 9, 63, 64, 3 * PEOCRC_SHORT - 1, 3 * PEOCRC_SHORT,
+        3 * PEOCRC_SHORT + 1, 3 * PEOCRC_LONG - 8, 3 * PEOCRC_LONG,
+        3 * PEOCRC_LONG + 3 * PEOCRC_SHORT + 13, 6 * PEOCRC_LONG + 5, 100000
+    };
+    unsigned char *buf;
+    char detail[64];
+    uint32_t sw, crc;
+    size_t n, cut;
+    int j, align;
+
+    check(peocrc32c(0, "123456789", 9) == 0xE3069283, "CRC-32C of 123456789", peocrc_method());
+    check(peocrc32c(0, "", 0) == 0, "CRC-32C of nothing", peocrc_method());
+    buf = (unsigned char *)malloc(100000 + 8);
+    for (n = 0; n < 100000 + 8; n++) buf[n] = (unsigned char)rnd(256);
+    for (j = 0; j < (int)(sizeof(lens)/sizeof(lens[0])); j++) {
+        n = lens[j];
+        for (align = 0; align < 8; align++) {
+            sprintf(detail, "%lu bytes at +%d", (unsigned long)n, align);
+            sw = ~peocrc32c_sw(~0U, buf + align, n);
+#if PEOCRC_X86
+            if (peocrc_method_ > 0) {
+                check(~peocrc32c_hw(~0U, buf + align, n) == sw, "SSE4.2 CRC == table CRC", detail);
+            }
+#endif
+            check(peocrc32c(0, buf + align, n) == sw, "peocrc32c == table CRC", detail);
+            cut = n ? rnd((unsigned long)n) : 0;
+            crc = peocrc32c(peocrc32c(0, buf + align, cut), buf + align + cut, n - cut);
+            check(crc == sw, "CRC in two pieces == CRC in one", detail);
+        }
+    }
+    free(buf);
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage:  peotest [-d fixtures]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    int j;
+
+    for (j = 1; j < argc; j++) {
+        if (strcmp(argv[j], "-d") == 0 && j + 1 < argc) fixdir = argv[++j];
+        else usage();
+    }
+    test_fixtures();
+    test_bundles();
+    test_lz();
+    test_open();
+    test_crc();
+    printf("%d checks, %d failed\n", nchecks, nfailed);
+    return nfailed ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+/* peotestutil.h: what peotest.c and peobench.c have in common --
+   repeatable random numbers, a wall clock, whole-file reads and writes,
+   and a generator for payloads like the ones we bundle.
+   Include it after peoverlay.h, in one file of a program.
+ */
+
+#ifndef PEOTESTUTIL_H
+#define PEOTESTUTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "peoverlay.h"
+
+/* Random numbers from a fixed seed, so that one run is like the next. */
+static unsigned long seed = 1;
+
+PEO_FUNC unsigned long rnd(unsigned long n)
+{
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned long)((seed >> 33) % n);
+}
+
+/* Wall-clock time in seconds. */
+PEO_FUNC double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Read a whole file into memory, with a spare byte after it.
+ * Exit:  Returns the malloc'ed contents and their size in *size;
+ *          exits if an error occurs.
+ */
+PEO_FUNC unsigned char *readfile(const char *path, size_t *size)
+{
+    PeoFile pf;
+    unsigned char *buf;
+    int err;
+
+    if (peo_open(&pf, path) != PEO_OK) {
+        fprintf(stderr, "Error opening %s\n", path);
+        exit(2);
+    }
+    *size = (size_t)pf.size;
+    buf = (unsigned char *)malloc(*size + 1);
+    err = buf ? peo_read(&pf, 0, buf, *size) : PEO_ERR_NOMEM;
+    peo_close(&pf);
+    if (err != PEO_OK) {
+        fprintf(stderr, "Error reading %s: %s\n", path, peo_strerror(err));
+        exit(2);
+    }
+    return buf;
+}
+
+/* Write a whole file; exits if an error occurs. */
+PEO_FUNC void writefile(const char *path, const void *buf, size_t size)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp || fwrite(buf, 1, size, fp) != size || fclose(fp) != 0) {
+        fprintf(stderr, "Error writing %s\n", path);
+        exit(2);
+    }
+}
+
+/* Make a payload of size bytes: alternating stretches of script and of
+ * a comma-separated table, which compress well.  If noisy, a quarter of
+ * the stretches are instead random bytes, up to two blocks of them,
+ * which do not compress.
+ * Exit:  Returns the malloc'ed payload, with 64 spare bytes after it;
+ *          exits if there is not enough memory.
+ */
+PEO_FUNC unsigned char *make_payload(size_t size, int noisy)
+{
+    static const char *words[] = {
+        "var", "function", "return", "if", "else", "for", "while", "items",
+        "count", "name", "value", "result", "length", "push", "index", "total",
+        "WScript.Echo", "fso.GetFolder", "file.Size", "path", "line", "null",
+        "10 PRINT", "GOSUB", "\t", "\r\n"
+    };
+    const int nwords = (int)(sizeof(words)/sizeof(words[0]));
+    unsigned char *buf = (unsigned char *)malloc(size + 64);
+    size_t pos = 0, n;
+    int j, k;
+
+    if (!buf) {
+        fprintf(stderr, "Out of memory\n");
+        exit(2);
+    }
+    while (pos < size) {
+        if (noisy && rnd(4) == 0) {
+            for (n = rnd(2 * PEO_BLOCK_SIZE); n > 0 && pos < size; n--) {
+                buf[pos++] = (unsigned char)rnd(256);
+            }
+        } else if (rnd(2)) {
+            for (j = 0; j < 50 && pos < size; j++) {
+                pos += sprintf((char *)buf + pos, "%*s", (int)rnd(4) * 4, "");
+                for (k = (int)rnd(8) + 1; k > 0 && pos < size; k--) {
+                    pos += sprintf((char *)buf + pos, "%s ", words[rnd(nwords)]);
+                }
+                pos += sprintf((char *)buf + pos, ";\n");
+            }
+        } else {
+            for (j = 0; j < 50 && pos < size; j++) {
+                pos += sprintf((char *)buf + pos, "%lu,%lu.%02lu,%s,%lu\n",
+                    rnd(100000), rnd(1000), rnd(100), words[rnd(nwords)], rnd(10));
+            }
+        }
+    }
+    return buf;
+}
+
+#endif
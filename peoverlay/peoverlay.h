@@ -0,0 +1,809 @@
+/* peoverlay.h: find data appended to a Windows PE executable file.
+
+   Data copied onto the end of an EXE (copy /b stub.exe+payload out.exe)
+   is called an overlay.  To find where it starts, we locate the end of
+   the PE image from the DOS header, the NT headers, the section table and,
+   for unstripped images, the COFF string table.  Only those few hundred
+   bytes are read, with a handful of small reads, so finding the payload in
+   a 100 MB bundle costs kilobytes of I/O.  The payload itself is read only
+   when the caller asks for it.
+
+   This file does not depend on <windows.h>; the PE structures are decoded
+   byte by byte, so it builds and runs on Linux and macOS as well as Windows.
+   All functions are static, so just #include this file; programs in the
+   other directories use  #include "../peoverlay/peoverlay.h".
+
+   Example:
+      PeoFile pf;
+      PeoInfo info;
+      if (peo_open(&pf, path) == PEO_OK && peo_locate_file(&pf, &info) == PEO_OK)
+          printf("Payload is %llu bytes at %llu\n",
+              (unsigned long long)(pf.size - info.imageend),
+              (unsigned long long)info.imageend);
+
+   Instead of a bare overlay, an executable may end with a trailer that
+   indexes any number of named payloads.  The trailer is found by reading
+   the last PEO_FOOTER_SIZE bytes of the file, with no header parsing at
+   all, so it also works on images that UPX has packed.  The layout,
+   all integers little-endian, is:
+      image | start | entry data ... | index: n entries | footer
+      entry  (64 bytes): name[40] (null-padded), offset u64, length u64,
+                         flags u32, crc u32
+      footer (24 bytes): magic "PEOTRAIL", version u32, n u32,
+                         index offset u64
+      start   (8 bytes): magic "PEOSTART"
+   Entry offsets are from the start of the file.  peopack writes trailers.
+   The start marker is not needed to find the entries; it is there so
+   that a bundle whose end has been cut off, footer and all, is not
+   mistaken for a bare overlay and run.
+
+   An entry with the PEO_F_LZ flag holds a compressed stream, which is
+   decompressed as it is read (see peolz.h for the codec):
+      stream: uncompressed size u64 | blocks ...
+      block:  uncompressed size u32 | stored size u32 | stored data
+   Blocks are at most PEO_BLOCK_SIZE bytes uncompressed and independent of
+   each other.  A block whose stored size equals its uncompressed size is
+   stored as is, because compressing it did not make it smaller.
+
+   An entry with the PEO_F_CRC flag has the CRC-32C (see peocrc.h) of its
+   uncompressed data in its crc field; otherwise that field is zero.  The
+   CRC is checked as the data is read, a block at a time while the block
+   is in the cache, so checking costs little more than reading.
+
+   Credits to https://stackoverflow.com/questions/34684660/how-to-determine-the-size-of-an-pe-executable-file-from-headers-and-or-footers
+ */
+
+#ifndef PEOVERLAY_H
+#define PEOVERLAY_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
+
+#include "peolz.h"
+#include "peocrc.h"
+
+/* All functions are static; not every program uses every one. */
+#if defined(__GNUC__)
+#define PEO_FUNC static __attribute__((unused))
+#else
+#define PEO_FUNC static
+#endif
+
+#define PEO_OK            0
+#define PEO_ERR_OPEN      1
+#define PEO_ERR_READ      2
+#define PEO_ERR_DOS       3
+#define PEO_ERR_NT        4
+#define PEO_ERR_SECTIONS  5
+#define PEO_ERR_UPX       6
+#define PEO_ERR_OFFSET    7
+#define PEO_ERR_NOTRAILER 8
+#define PEO_ERR_TRAILER   9
+#define PEO_ERR_NOENTRY   10
+#define PEO_ERR_NOMEM     11
+#define PEO_ERR_WRITE     12
+#define PEO_ERR_DATA      13
+#define PEO_ERR_CHECKSUM  14
+
+/* The Windows loader refuses images with more sections than this. */
+#define PEO_MAX_SECTIONS  96
+
+#define PEO_DOS_SIGNATURE 0x5A4D      /* "MZ" */
+#define PEO_NT_SIGNATURE  0x00004550  /* "PE\0\0" */
+#define PEO_SIZEOF_FILE_HEADER    20
+#define PEO_SIZEOF_SECTION_HEADER 40
+#define PEO_SIZEOF_SYMBOL         18
+
+#define PEO_START_MAGIC     "PEOSTART"
+#define PEO_START_SIZE      8
+#define PEO_TRAILER_MAGIC   "PEOTRAIL"
+#define PEO_TRAILER_VERSION 1
+#define PEO_FOOTER_SIZE     24
+#define PEO_ENTRY_SIZE      64
+#define PEO_NAME_MAX        40
+#define PEO_MAX_ENTRIES     256
+
+/* Entry flags */
+#define PEO_F_LZ            0x1   /* data is a compressed stream */
+#define PEO_F_CRC           0x2   /* crc is the CRC-32C of the data */
+
+#define PEO_BLOCK_SIZE      65536
+
+typedef struct {
+    char     name[9];         /* null-terminated copy of the 8-byte name */
+    uint32_t virtualsize;
+    uint32_t virtualaddress;
+    uint32_t rawsize;         /* SizeOfRawData */
+    uint32_t rawptr;          /* PointerToRawData */
+} PeoSection;
+
+typedef struct {
+    uint64_t   imageend;      /* end of the PE image = offset of any payload */
+    uint16_t   machine;
+    uint32_t   filealign;
+    int        stripped;      /* nonzero if there is no COFF symbol table */
+    int        nsections;
+    PeoSection sections[PEO_MAX_SECTIONS];
+} PeoInfo;
+
+typedef struct {
+    char     name[PEO_NAME_MAX + 1];
+    uint64_t offset;          /* from the start of the file */
+    uint64_t length;          /* bytes stored in the file */
+    uint32_t flags;
+    uint32_t crc;             /* if flags has PEO_F_CRC */
+} PeoEntry;
+
+typedef struct {
+    int      nentries;
+    PeoEntry entries[PEO_MAX_ENTRIES];
+} PeoTrailer;
+
+/* Read len bytes at offset into buf.  Returns 0 if successful. */
+typedef int (*PeoReadFn)(void *ctx, uint64_t offset, void *buf, size_t len);
+
+/* Accept the next len bytes of a payload.  Returns 0 to continue. */
+typedef int (*PeoSinkFn)(void *ctx, const unsigned char *buf, size_t len);
+
+/* An open file, read with pread (or fseek/fread on Windows), so that
+   no more of it is read than is asked for. */
+typedef struct {
+#ifdef _WIN32
+    FILE    *fp;
+#else
+    int      fd;
+#endif
+    uint64_t size;
+} PeoFile;
+
+/* A file image that is already in memory, for example from mmap. */
+typedef struct {
+    const unsigned char *buf;
+    size_t size;
+} PeoMem;
+
+PEO_FUNC uint16_t peo_get16(const unsigned char *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+PEO_FUNC uint32_t peo_get32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+        ((uint32_t)p[3] << 24);
+}
+
+PEO_FUNC uint64_t peo_get64(const unsigned char *p)
+{
+    return (uint64_t)peo_get32(p) | ((uint64_t)peo_get32(p + 4) << 32);
+}
+
+PEO_FUNC void peo_put32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+PEO_FUNC void peo_put64(unsigned char *p, uint64_t v)
+{
+    peo_put32(p, (uint32_t)v);
+    peo_put32(p + 4, (uint32_t)(v >> 32));
+}
+
+PEO_FUNC const char *peo_strerror(int err)
+{
+    switch (err) {
+    case PEO_OK:           return "No error";
+    case PEO_ERR_OPEN:     return "Error opening file";
+    case PEO_ERR_READ:     return "Error reading file";
+    case PEO_ERR_DOS:      return "Invalid DOS signature";
+    case PEO_ERR_NT:       return "Invalid NT signature";
+    case PEO_ERR_SECTIONS: return "Invalid section table";
+    case PEO_ERR_UPX:      return "Unstripped UPX Compressed Executables are NOT SUPPORTED";
+    case PEO_ERR_OFFSET:   return "Offset exceeds file size";
+    case PEO_ERR_NOTRAILER: return "No payload trailer";
+    case PEO_ERR_TRAILER:  return "Invalid payload trailer";
+    case PEO_ERR_NOENTRY:  return "No such payload";
+    case PEO_ERR_NOMEM:    return "Error allocating memory";
+    case PEO_ERR_WRITE:    return "Error writing file";
+    case PEO_ERR_DATA:     return "Damaged compressed payload";
+    case PEO_ERR_CHECKSUM: return "Payload checksum does not match";
+    }
+    return "Unknown error";
+}
+
+/* Find the end of the PE image in an executable file.
+ * Entry: readfn, ctx: how to read the file
+ *        filesize: size of the file in bytes
+ * Exit:  Returns PEO_OK and fills in info if successful; info->imageend
+ *          is the offset of the end of the PE image.  Normally this is
+ *          equal to filesize, but is less if data has been appended.
+ *        Otherwise returns one of the PEO_ERR_ codes.
+ */
+PEO_FUNC int peo_locate(PeoReadFn readfn, void *ctx, uint64_t filesize, PeoInfo *info)
+{
+    unsigned char dos[64];
+    unsigned char nt[4 + PEO_SIZEOF_FILE_HEADER + 40];
+    unsigned char sects[PEO_MAX_SECTIONS * PEO_SIZEOF_SECTION_HEADER];
+    unsigned char strtab[4];
+    uint32_t lfanew, symptr, nsymbols, align;
+    uint16_t optsize;
+    uint64_t offset = 0, sectend, end;
+    int j;
+
+    memset(info, 0, sizeof(*info));
+    if (filesize < sizeof(dos) || readfn(ctx, 0, dos, sizeof(dos))) {
+        return PEO_ERR_DOS;
+    }
+    if (peo_get16(dos) != PEO_DOS_SIGNATURE) return PEO_ERR_DOS;
+
+    /* NT signature, file header, and enough of the optional header to
+       get FileAlignment, which is at the same place in PE32 and PE32+. */
+    lfanew = peo_get32(dos + 0x3C);
+    if ((uint64_t)lfanew + sizeof(nt) > filesize || readfn(ctx, lfanew, nt, sizeof(nt))) {
+        return PEO_ERR_NT;
+    }
+    if (peo_get32(nt) != PEO_NT_SIGNATURE) return PEO_ERR_NT;
+    info->machine = peo_get16(nt + 4);
+    info->nsections = peo_get16(nt + 6);
+    symptr = peo_get32(nt + 12);
+    nsymbols = peo_get32(nt + 16);
+    optsize = peo_get16(nt + 20);
+    info->filealign = peo_get32(nt + 24 + 36);
+
+    if (info->nsections < 1 || info->nsections > PEO_MAX_SECTIONS) {
+        return PEO_ERR_SECTIONS;
+    }
+    sectend = (uint64_t)lfanew + 24 + optsize;
+    if (sectend + (uint64_t)info->nsections * PEO_SIZEOF_SECTION_HEADER > filesize ||
+        readfn(ctx, sectend, sects, (size_t)info->nsections * PEO_SIZEOF_SECTION_HEADER)) {
+        return PEO_ERR_SECTIONS;
+    }
+    for (j = 0; j < info->nsections; j++) {
+        const unsigned char *sh = sects + j * PEO_SIZEOF_SECTION_HEADER;
+        PeoSection *s = &info->sections[j];
+        memcpy(s->name, sh, 8);
+        s->name[8] = '\0';
+        s->virtualsize = peo_get32(sh + 8);
+        s->virtualaddress = peo_get32(sh + 12);
+        s->rawsize = peo_get32(sh + 16);
+        s->rawptr = peo_get32(sh + 20);
+    }
+
+    if (symptr) {
+        if (0 == strncmp(info->sections[0].name, "UPX", 3)) {
+            /* UPX produces exe with invalid PointerToSymbolTable */
+            return PEO_ERR_UPX;
+        }
+        /* The string table follows the symbol table; its first 4 bytes
+           give its length, including those 4 bytes. */
+        offset = (uint64_t)symptr + (uint64_t)nsymbols * PEO_SIZEOF_SYMBOL;
+        if (offset + sizeof(strtab) > filesize || readfn(ctx, offset, strtab, sizeof(strtab))) {
+            return PEO_ERR_OFFSET;
+        }
+        offset += peo_get32(strtab);
+    } else {
+        /* stripped: the image ends with the raw data of the last section.
+           Sections are normally in file order, but take the maximum anyway. */
+        info->stripped = 1;
+        for (j = 0; j < info->nsections; j++) {
+            end = (uint64_t)info->sections[j].rawptr + info->sections[j].rawsize;
+            if (info->sections[j].rawsize && end > offset) offset = end;
+        }
+    }
+
+    align = info->filealign;
+    if (align && offset % align) offset = (offset/align + 1)*align;
+
+    if (offset > filesize) return PEO_ERR_OFFSET;
+    info->imageend = offset;
+    return PEO_OK;
+}
+
+/* Open a file for peo_locate_file and peo_read.
+ * Exit:  Returns PEO_OK, or PEO_ERR_OPEN if the file cannot be opened
+ *          or is not a regular file.  A FIFO or device is opened without
+ *          waiting and then rejected, so that opening one does not hang.
+ */
+PEO_FUNC int peo_open(PeoFile *pf, const char *path)
+{
+#ifdef _WIN32
+    pf->fp = fopen(path, "rb");
+    if (!pf->fp) return PEO_ERR_OPEN;
+    _fseeki64(pf->fp, 0, SEEK_END);
+    pf->size = (uint64_t)_ftelli64(pf->fp);
+#else
+    struct stat st;
+    pf->fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (pf->fd < 0) return PEO_ERR_OPEN;
+    if (fstat(pf->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(pf->fd);
+        return PEO_ERR_OPEN;
+    }
+    pf->size = (uint64_t)st.st_size;
+#endif
+    return PEO_OK;
+}
+
+PEO_FUNC void peo_close(PeoFile *pf)
+{
+#ifdef _WIN32
+    fclose(pf->fp);
+#else
+    close(pf->fd);
+#endif
+}
+
+/* Read part of an open file.  Matches PeoReadFn, with ctx a PeoFile*. */
+PEO_FUNC int peo_read(void *ctx, uint64_t offset, void *buf, size_t len)
+{
+    PeoFile *pf = (PeoFile *)ctx;
+#ifdef _WIN32
+    if (_fseeki64(pf->fp, (__int64)offset, SEEK_SET) != 0) return PEO_ERR_READ;
+    if (fread(buf, 1, len, pf->fp) != len) return PEO_ERR_READ;
+#else
+    size_t done = 0;
+    ssize_t n;
+    while (done < len) {
+        n = pread(pf->fd, (char *)buf + done, len - done, (off_t)(offset + done));
+        if (n <= 0) return PEO_ERR_READ;
+        done += (size_t)n;
+    }
+#endif
+    return PEO_OK;
+}
+
+/* Read part of a file image in memory.  Matches PeoReadFn, with ctx a PeoMem*. */
+PEO_FUNC int peo_read_mem(void *ctx, uint64_t offset, void *buf, size_t len)
+{
+    PeoMem *pm = (PeoMem *)ctx;
+    if (offset > pm->size || len > pm->size - offset) return PEO_ERR_READ;
+    memcpy(buf, pm->buf + offset, len);
+    return PEO_OK;
+}
+
+PEO_FUNC int peo_locate_file(PeoFile *pf, PeoInfo *info)
+{
+    return peo_locate(peo_read, pf, pf->size, info);
+}
+
+PEO_FUNC int peo_locate_mem(const unsigned char *buf, size_t size, PeoInfo *info)
+{
+    PeoMem pm;
+    pm.buf = buf;
+    pm.size = size;
+    return peo_locate(peo_read_mem, &pm, size, info);
+}
+
+/* Read the payload trailer at the end of a file.
+ * Entry: readfn, ctx: how to read the file
+ *        filesize: size of the file in bytes
+ * Exit:  Returns PEO_OK and fills in tr if successful.
+ *        Returns PEO_ERR_NOTRAILER if the file does not end with a trailer,
+ *          or another PEO_ERR_ code if it is damaged.
+ */
+PEO_FUNC int peo_read_trailer(PeoReadFn readfn, void *ctx, uint64_t filesize, PeoTrailer *tr)
+{
+    unsigned char footer[PEO_FOOTER_SIZE];
+    unsigned char index[PEO_MAX_ENTRIES * PEO_ENTRY_SIZE];
+    uint64_t indexoff, indexlen;
+    uint32_t count;
+    int j;
+
+    tr->nentries = 0;
+    if (filesize < PEO_FOOTER_SIZE ||
+        readfn(ctx, filesize - PEO_FOOTER_SIZE, footer, PEO_FOOTER_SIZE)) {
+        return PEO_ERR_NOTRAILER;
+    }
+    if (memcmp(footer, PEO_TRAILER_MAGIC, 8) != 0) return PEO_ERR_NOTRAILER;
+    if (peo_get32(footer + 8) != PEO_TRAILER_VERSION) return PEO_ERR_TRAILER;
+    count = peo_get32(footer + 12);
+    indexoff = peo_get64(footer + 16);
+    indexlen = (uint64_t)count * PEO_ENTRY_SIZE;
+    if (count > PEO_MAX_ENTRIES || indexoff > filesize - PEO_FOOTER_SIZE ||
+        indexoff + indexlen != filesize - PEO_FOOTER_SIZE) {
+        return PEO_ERR_TRAILER;
+    }
+    if (readfn(ctx, indexoff, index, (size_t)indexlen)) return PEO_ERR_READ;
+
+    for (j = 0; j < (int)count; j++) {
+        const unsigned char *ep = index + j * PEO_ENTRY_SIZE;
+        PeoEntry *e = &tr->entries[j];
+        memcpy(e->name, ep, PEO_NAME_MAX);
+        e->name[PEO_NAME_MAX] = '\0';
+        e->offset = peo_get64(ep + 40);
+        e->length = peo_get64(ep + 48);
+        e->flags = peo_get32(ep + 56);
+        e->crc = peo_get32(ep + 60);
+        if (e->offset > indexoff || e->length > indexoff - e->offset) {
+            return PEO_ERR_TRAILER;
+        }
+    }
+    tr->nentries = (int)count;
+    return PEO_OK;
+}
+
+PEO_FUNC int peo_read_trailer_file(PeoFile *pf, PeoTrailer *tr)
+{
+    return peo_read_trailer(peo_read, pf, pf->size, tr);
+}
+
+/* Find a payload by name.
+ * Entry: name: the name wanted, or NULL for the first (main) payload
+ * Exit:  Returns the entry, or NULL if there is none.
+ */
+PEO_FUNC const PeoEntry *peo_find_entry(const PeoTrailer *tr, const char *name)
+{
+    int j;
+    if (!name) return tr->nentries ? &tr->entries[0] : NULL;
+    for (j = 0; j < tr->nentries; j++) {
+        if (strcmp(tr->entries[j].name, name) == 0) return &tr->entries[j];
+    }
+    return NULL;
+}
+
+/* Write the index and footer of a trailer, after the entry data.
+ * Entry: fp: file positioned just after the last entry's data
+ *        indexoff: that position, as an offset from the start of the file
+ * Exit:  Returns PEO_OK, or PEO_ERR_WRITE if writing fails.
+ */
+PEO_FUNC int peo_write_trailer(FILE *fp, uint64_t indexoff, const PeoEntry *entries, int n)
+{
+    unsigned char ep[PEO_ENTRY_SIZE];
+    unsigned char footer[PEO_FOOTER_SIZE];
+    int j;
+
+    for (j = 0; j < n; j++) {
+        /* The name is at most PEO_NAME_MAX bytes, null-padded. */
+        memset(ep, 0, sizeof(ep));
+        memcpy(ep, entries[j].name, strlen(entries[j].name));
+        peo_put64(ep + 40, entries[j].offset);
+        peo_put64(ep + 48, entries[j].length);
+        peo_put32(ep + 56, entries[j].flags);
+        peo_put32(ep + 60, entries[j].crc);
+        if (fwrite(ep, 1, sizeof(ep), fp) != sizeof(ep)) return PEO_ERR_WRITE;
+    }
+    memcpy(footer, PEO_TRAILER_MAGIC, 8);
+    peo_put32(footer + 8, PEO_TRAILER_VERSION);
+    peo_put32(footer + 12, (uint32_t)n);
+    peo_put64(footer + 16, indexoff);
+    if (fwrite(footer, 1, sizeof(footer), fp) != sizeof(footer)) return PEO_ERR_WRITE;
+    return PEO_OK;
+}
+
+/* Write the start marker, just after the image.
+ * Exit:  Returns PEO_OK, or PEO_ERR_WRITE if writing fails.
+ */
+PEO_FUNC int peo_write_start(FILE *fp)
+{
+    if (fwrite(PEO_START_MAGIC, 1, PEO_START_SIZE, fp) != PEO_START_SIZE) return PEO_ERR_WRITE;
+    return PEO_OK;
+}
+
+/* Check an overlay that has no trailer.
+ * Entry: start: the offset of the overlay, the end of the PE image
+ * Exit:  Returns PEO_ERR_TRAILER if the overlay begins with the start
+ *          marker, because then it is a bundle whose trailer has been
+ *          cut off; otherwise PEO_OK.
+ */
+PEO_FUNC int peo_check_bare(PeoReadFn readfn, void *ctx, uint64_t filesize, uint64_t start)
+{
+    unsigned char magic[PEO_START_SIZE];
+
+    if (start > filesize || filesize - start < PEO_START_SIZE) return PEO_OK;
+    if (readfn(ctx, start, magic, sizeof(magic))) return PEO_ERR_READ;
+    if (memcmp(magic, PEO_START_MAGIC, PEO_START_SIZE) == 0) return PEO_ERR_TRAILER;
+    return PEO_OK;
+}
+
+/* Get the uncompressed size of an entry.
+ * Exit:  Returns PEO_OK and sets *size, or returns a PEO_ERR_ code.
+ *        The size of a compressed entry is checked against what could
+ *          be stored in its length, so that a damaged size cannot make
+ *          the caller allocate gigabytes: PEO_ERR_DATA if it is larger.
+ */
+PEO_FUNC int peo_entry_size(PeoReadFn readfn, void *ctx, const PeoEntry *e, uint64_t *size)
+{
+    unsigned char hdr[8];
+    uint64_t stored, blocks, max;
+
+    *size = e->length;
+    if (!(e->flags & PEO_F_LZ)) return PEO_OK;
+    if (e->length < sizeof(hdr)) return PEO_ERR_DATA;
+    if (readfn(ctx, e->offset, hdr, sizeof(hdr))) return PEO_ERR_READ;
+    *size = peo_get64(hdr);
+
+    /* Each block has an 8-byte header and at most PEO_BLOCK_SIZE bytes,
+       and no block expands more than PEOLZ_MAXRATIO times. */
+    stored = e->length - sizeof(hdr);
+    blocks = stored / 8;
+    max = stored * PEOLZ_MAXRATIO;
+    if (max > blocks * PEO_BLOCK_SIZE) max = blocks * PEO_BLOCK_SIZE;
+    if (*size > max) return PEO_ERR_DATA;
+    return PEO_OK;
+}
+
+/* Read an entry a block at a time, decompressing it if need be, and
+ * pass each block to sink.  Only one block is held in memory, so a large
+ * payload can be processed as it is read.  Each read of a compressed
+ * block also fetches the header of the next one, so there is one read
+ * per block.  If the entry has a CRC, it is checked at the end, so a
+ * sink that acts on the data before then should be ready to undo it.
+ * Exit:  Returns PEO_OK, a PEO_ERR_ code, or the nonzero value returned
+ *          by sink.
+ */
+PEO_FUNC int peo_read_entry(PeoReadFn readfn, void *ctx, const PeoEntry *e,
+    PeoSinkFn sink, void *sinkctx)
+{
+    unsigned char hdr[16];
+    unsigned char *zbuf, *rbuf;
+    const unsigned char *data;
+    uint64_t pos = e->offset, end = e->offset + e->length, total = 0, done = 0;
+    uint32_t rawlen, zlen, crc = 0;
+    size_t n;
+    int err = PEO_OK, check = (e->flags & PEO_F_CRC) != 0;
+
+    /* Room for a block as stored, plus the next block's header */
+    zbuf = (unsigned char *)malloc(PEO_BLOCK_SIZE + 8 + PEO_BLOCK_SIZE);
+    if (!zbuf) return PEO_ERR_NOMEM;
+    rbuf = zbuf + PEO_BLOCK_SIZE + 8;
+
+    if (!(e->flags & PEO_F_LZ)) {
+        for (; pos < end && !err; pos += n) {
+            n = end - pos < PEO_BLOCK_SIZE ? (size_t)(end - pos) : PEO_BLOCK_SIZE;
+            if (readfn(ctx, pos, zbuf, n)) {
+                err = PEO_ERR_READ;
+                break;
+            }
+            if (check) crc = peocrc32c(crc, zbuf, n);
+            err = sink(sinkctx, zbuf, n);
+        }
+        if (!err && check && crc != e->crc) err = PEO_ERR_CHECKSUM;
+        free(zbuf);
+        return err;
+    }
+
+    /* The stream header, and the first block's header if there is one */
+    n = e->length < sizeof(hdr) ? (size_t)e->length : sizeof(hdr);
+    if (n < 8) err = PEO_ERR_DATA;
+    else if (readfn(ctx, pos, hdr, n)) err = PEO_ERR_READ;
+    else total = peo_get64(hdr);
+    memmove(zbuf, hdr + 8, 8);
+    pos += n;
+    n -= 8;
+    while (!err && n) {
+        if (n < 8) {
+            err = PEO_ERR_DATA;
+            break;
+        }
+        rawlen = peo_get32(zbuf);
+        zlen = peo_get32(zbuf + 4);
+        if (rawlen > PEO_BLOCK_SIZE || zlen > rawlen || zlen > end - pos || rawlen > total - done) {
+            err = PEO_ERR_DATA;
+            break;
+        }
+        n = end - pos - zlen < 8 ? (size_t)(end - pos - zlen) : 8;
+        data = zlen == rawlen ? zbuf : rbuf;
+        if (readfn(ctx, pos, zbuf, zlen + n)) {
+            err = PEO_ERR_READ;
+        } else if (zlen != rawlen && peolz_decompress(zbuf, zlen, rbuf, rawlen) != (long)rawlen) {
+            err = PEO_ERR_DATA;
+        } else {
+            if (check) crc = peocrc32c(crc, data, rawlen);
+            err = sink(sinkctx, data, rawlen);
+        }
+        memmove(zbuf, zbuf + zlen, n);
+        pos += zlen + n;
+        done += rawlen;
+    }
+    if (!err && done != total) err = PEO_ERR_DATA;
+    if (!err && check && crc != e->crc) err = PEO_ERR_CHECKSUM;
+    free(zbuf);
+    return err;
+}
+
+/* Copy a payload from one file to another, compressing it if e->flags
+ * includes PEO_F_LZ, and computing its CRC if it includes PEO_F_CRC.
+ * Entry: out: file positioned where the entry's data goes
+ *        in: file holding the payload, positioned at its start
+ * Exit:  Returns PEO_OK and sets e->length to the number of bytes written
+ *          and e->crc, or returns PEO_ERR_READ, PEO_ERR_WRITE or
+ *          PEO_ERR_NOMEM.
+ */
+PEO_FUNC int peo_write_entry(FILE *out, FILE *in, PeoEntry *e)
+{
+    unsigned char hdr[8];
+    unsigned char *rbuf, *zbuf;
+    uint64_t total = 0, done = 0;
+    uint64_t *length = &e->length;
+    uint32_t flags = e->flags;
+    size_t n, zlen;
+    int err = PEO_OK;
+
+    *length = 0;
+    e->crc = 0;
+    rbuf = (unsigned char *)malloc(PEO_BLOCK_SIZE + PEOLZ_BOUND(PEO_BLOCK_SIZE));
+    if (!rbuf) return PEO_ERR_NOMEM;
+    zbuf = rbuf + PEO_BLOCK_SIZE;
+
+    if (flags & PEO_F_LZ) {
+        /* The stream starts with the uncompressed size, so that a reader
+           can allocate its buffer before decompressing. */
+#ifdef _WIN32
+        if (_fseeki64(in, 0, SEEK_END) == 0) total = (uint64_t)_ftelli64(in);
+        if (_fseeki64(in, 0, SEEK_SET) != 0) err = PEO_ERR_READ;
+#else
+        if (fseeko(in, 0, SEEK_END) == 0) total = (uint64_t)ftello(in);
+        if (fseeko(in, 0, SEEK_SET) != 0) err = PEO_ERR_READ;
+#endif
+        peo_put64(hdr, total);
+        if (!err && fwrite(hdr, 1, sizeof(hdr), out) != sizeof(hdr)) err = PEO_ERR_WRITE;
+        *length += sizeof(hdr);
+    }
+
+    while (!err && (n = fread(rbuf, 1, PEO_BLOCK_SIZE, in)) > 0) {
+        done += n;
+        if (flags & PEO_F_CRC) e->crc = peocrc32c(e->crc, rbuf, n);
+        if (!(flags & PEO_F_LZ)) {
+            if (fwrite(rbuf, 1, n, out) != n) err = PEO_ERR_WRITE;
+            *length += n;
+            continue;
+        }
+        zlen = peolz_compress(rbuf, n, zbuf);
+        if (zlen >= n) {
+            memcpy(zbuf, rbuf, n);
+            zlen = n;
+        }
+        peo_put32(hdr, (uint32_t)n);
+        peo_put32(hdr + 4, (uint32_t)zlen);
+        if (fwrite(hdr, 1, sizeof(hdr), out) != sizeof(hdr) ||
+            fwrite(zbuf, 1, zlen, out) != zlen) {
+            err = PEO_ERR_WRITE;
+        }
+        *length += sizeof(hdr) + zlen;
+    }
+    if (!err && ferror(in)) err = PEO_ERR_READ;
+    /* The file changed size while we were reading it. */
+    if (!err && (flags & PEO_F_LZ) && done != total) err = PEO_ERR_READ;
+    free(rbuf);
+    return err;
+}
+
+/* Where peo_load_payload's sink puts the data */
+typedef struct {
+    unsigned char *buf;
+    size_t size;
+    size_t pos;
+} PeoBuffer;
+
+PEO_FUNC int peo_sink_buffer(void *ctx, const unsigned char *buf, size_t len)
+{
+    PeoBuffer *pb = (PeoBuffer *)ctx;
+    if (len > pb->size - pb->pos) return PEO_ERR_DATA;
+    memcpy(pb->buf + pb->pos, buf, len);
+    pb->pos += len;
+    return PEO_OK;
+}
+
+/* Load a payload into memory.
+ * Entry: path: the executable file
+ *        name: name of the payload wanted, or NULL for the main one
+ * Exit:  Returns a malloc'ed buffer holding the payload, null-terminated,
+ *          and sets *size to its size; or returns NULL and sets *err.
+ *        If the file has a trailer, the payload is the named entry,
+ *          decompressed and checked if need be.  Otherwise it is everything after
+ *          the PE image (and name must be NULL), unless that begins with
+ *          the start marker, which means the trailer has been cut off
+ *          (PEO_ERR_TRAILER).  Only the trailer or the headers are read,
+ *          and then the payload itself.
+ */
+PEO_FUNC unsigned char *peo_load_payload(const char *path, const char *name, size_t *size, int *err)
+{
+    PeoFile pf;
+    PeoTrailer tr;
+    PeoInfo info;
+    PeoEntry entry;
+    PeoBuffer pb;
+    const PeoEntry *e;
+    uint64_t length = 0;
+    uint32_t crc = 0;
+    size_t pos, n;
+
+    *err = peo_open(&pf, path);
+    if (*err != PEO_OK) return NULL;
+    memset(&entry, 0, sizeof(entry));
+    *err = peo_read_trailer_file(&pf, &tr);
+    if (*err == PEO_OK) {
+        e = peo_find_entry(&tr, name);
+        if (e) entry = *e;
+        else *err = PEO_ERR_NOENTRY;
+    } else if (*err == PEO_ERR_NOTRAILER && !name) {
+        *err = peo_locate_file(&pf, &info);
+        if (*err == PEO_OK) *err = peo_check_bare(peo_read, &pf, pf.size, info.imageend);
+        entry.offset = info.imageend;
+        entry.length = pf.size - info.imageend;
+    } else if (*err == PEO_ERR_NOTRAILER) {
+        *err = PEO_ERR_NOENTRY;
+    }
+    if (*err == PEO_OK) *err = peo_entry_size(peo_read, &pf, &entry, &length);
+    if (*err == PEO_OK && length >= (uint64_t)(size_t)-1) *err = PEO_ERR_NOMEM;
+    if (*err != PEO_OK) {
+        peo_close(&pf);
+        return NULL;
+    }
+
+    pb.size = (size_t)length;
+    pb.pos = 0;
+    pb.buf = (unsigned char *)malloc(pb.size + 1);
+    if (!pb.buf) {
+        *err = PEO_ERR_NOMEM;
+    } else if (entry.flags & PEO_F_LZ) {
+        *err = peo_read_entry(peo_read, &pf, &entry, peo_sink_buffer, &pb);
+        if (*err == PEO_OK && pb.pos != pb.size) *err = PEO_ERR_DATA;
+    } else {
+        /* Stored as is: read it straight into the buffer, in pieces if
+           there is a CRC, so each piece is checked while in the cache. */
+        for (pos = 0; pos < pb.size && *err == PEO_OK; pos += n) {
+            n = pb.size - pos;
+            if ((entry.flags & PEO_F_CRC) && n > 4 * PEO_BLOCK_SIZE) n = 4 * PEO_BLOCK_SIZE;
+            *err = peo_read(&pf, entry.offset + pos, pb.buf + pos, n);
+            if (entry.flags & PEO_F_CRC) crc = peocrc32c(crc, pb.buf + pos, n);
+        }
+        if (*err == PEO_OK && (entry.flags & PEO_F_CRC) && crc != entry.crc) {
+            *err = PEO_ERR_CHECKSUM;
+        }
+    }
+    if (pb.buf && *err != PEO_OK) {
+        free(pb.buf);
+        pb.buf = NULL;
+    } else if (pb.buf) {
+        pb.buf[pb.size] = '\0';
+        *size = pb.size;
+    }
+    peo_close(&pf);
+    return pb.buf;
+}
+
+/* Did peo_load_payload find a payload that it could not load, as opposed
+   to a file with no payload, or one it could not make sense of?  A
+   program that runs its payload should refuse to start in the first case,
+   and start without one in the second. */
+PEO_FUNC int peo_payload_damaged(int err)
+{
+    return err == PEO_ERR_TRAILER || err == PEO_ERR_CHECKSUM || err == PEO_ERR_DATA ||
+        err == PEO_ERR_READ || err == PEO_ERR_NOMEM;
+}
+
+/* Return the path of the running executable, for opening with peo_open,
+   or NULL where there is no way to find it.  On Linux this is a path
+   that the kernel resolves to the executable, which does not exist if
+   /proc is not mounted. */
+PEO_FUNC const char *peo_selfpath(void)
+{
+#if defined(_WIN32)
+    return _pgmptr;
+#elif defined(__APPLE__)
+    static char path[4096];
+    uint32_t size = sizeof(path);
+    return _NSGetExecutablePath(path, &size) == 0 ? path : NULL;
+#elif defined(__linux__) || defined(__CYGWIN__)
+    return "/proc/self/exe";
+#else
+    return NULL;
+#endif
+}
+
+#endif /* PEOVERLAY_H */
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Write the PE fixtures that peotest.c checks peoverlay.h against.
+
+The images are built field by field, like the headers a linker writes,
+but with tiny sections so that they can be checked in.  They are not
+meant to run.  Run this in this directory only to change the fixtures;
+then update the table in peotest.c.
+"""
+import struct
+
+FILEALIGN = 0x200
+
+
+def image(pe64, sections, symbols=None, lfanew=0x80, align=FILEALIGN):
+    """sections: (name, rawptr, rawsize) in table order.
+    symbols: (nsyms, strtab_len), placed after the section data; the file
+    is then padded to the file alignment, as the locator expects."""
+    nsect = len(sections)
+    optsize = 240 if pe64 else 224
+    headers = lfanew + 24 + optsize + 40 * nsect
+    end = max([headers] + [p + n for _, p, n in sections if n])
+    symptr = nsyms = 0
+    if symbols:
+        nsyms, strlen = symbols
+        symptr = end
+        end = symptr + 18 * nsyms + strlen
+        end = (end + align - 1) // align * align
+    out = bytearray(end)
+
+    # DOS header and stub
+    out[0:2] = b'MZ'
+    struct.pack_into('<H', out, 0x18, 0x40)
+    struct.pack_into('<I', out, 0x3C, lfanew)
+    msg = b'This program cannot be run in DOS mode.\r\r\n$'
+    out[0x4E:0x4E + len(msg)] = msg
+
+    # NT signature and file header
+    p = lfanew
+    out[p:p + 4] = b'PE\0\0'
+    struct.pack_into('<HHIIIHH', out, p + 4, 0x8664 if pe64 else 0x14C,
+                     nsect, 0x67000000, symptr, nsyms, optsize,
+                     0x22 if pe64 else 0x102)
+
+    # Optional header: only what a loader would look at first
+    o = p + 24
+    struct.pack_into('<H', out, o, 0x20B if pe64 else 0x10B)
+    struct.pack_into('<II', out, o + 32, 0x1000, align)
+    struct.pack_into('<I', out, o + 60, (headers + align - 1) // align * align)
+    struct.pack_into('<I', out, o + (108 if pe64 else 92), 16)
+
+    # Section table, and the sections filled with something recognisable
+    s = o + optsize
+    va = 0x1000
+    for name, rawptr, rawsize in sections:
+        struct.pack_into('<8sIIIIIIHHI', out, s, name, max(rawsize, 0x100), va,
+                         rawsize, rawptr, 0, 0, 0, 0, 0x60000020)
+        out[rawptr:rawptr + rawsize] = bytes([0xCC]) * rawsize
+        s += 40
+        va += 0x1000
+
+    if symbols:
+        struct.pack_into('<I', out, symptr + 18 * nsyms, strlen)
+    return bytes(out)
+
+
+def write(name, data):
+    with open(name, 'wb') as f:
+        f.write(data)
+
+
+# Stripped PE32, as from a release build with MSVC
+write('pe32.exe', image(False, [(b'.text', 0x400, 0x400), (b'.rdata', 0x800, 0x200),
+                                (b'.data', 0xA00, 0x200)]))
+# Stripped PE32+, with the section table out of file order and a .bss
+# that has a file offset but no data
+write('pe64.exe', image(True, [(b'.data', 0xC00, 0x200), (b'.text', 0x400, 0x600),
+                               (b'.rdata', 0xA00, 0x200), (b'.bss', 0x2000, 0)]))
+# Unstripped PE32, as from MinGW without -s: a COFF symbol table and
+# string table after the last section
+write('pe32sym.exe', image(False, [(b'.text', 0x400, 0x200), (b'.data', 0x600, 0x200)],
+                           symbols=(5, 23)))
+# Unstripped PE32+
+write('pe64sym.exe', image(True, [(b'.text', 0x400, 0x400), (b'.pdata', 0x800, 0x200)],
+                           symbols=(3, 4)))
+# Stripped image packed by UPX: UPX0 has no data in the file
+write('upx.exe', image(False, [(b'UPX0', 0x400, 0), (b'UPX1', 0x400, 0x600),
+                               (b'.rsrc', 0xA00, 0x200)]))
+# UPX leaves PointerToSymbolTable set when the input was unstripped
+write('upxsym.exe', image(False, [(b'UPX0', 0x400, 0), (b'UPX1', 0x400, 0x600)],
+                          symbols=(2, 4)))
+# pe32.exe cut off in the middle of its section table
+write('trunc.exe', image(False, [(b'.text', 0x400, 0x400), (b'.rdata', 0x800, 0x200),
+                                 (b'.data', 0xA00, 0x200)])[:0x80 + 24 + 224 + 60])
@@ -11,35 +11,466 @@
  *    spaces at BOL even after leading tabs.
  *  Modified by Mark Riordan on 25 February 2024 to compile
  *    on macOS clang 15.0.
+ *  Modified on 18 October 2026 to rewrite files named on the
+ *    command line in place, skipping files that would not
+ *    change, with an optional cache of files known to be clean.
+ *  Modified on 18 October 2026 to optionally count columns in
+ *    UTF-8 characters rather than bytes.
+ *  Modified on 18 October 2026 to move the algorithms into
+ *    tabelib.c, so that other programs can use them.  Build with:
+ *      cc -O2 -o tabe tabe.c tabelib.c
+ *  Modified on 18 October 2026 so that -b keeps the display
+ *    column of leading white space that has spaces before a tab.
+ *  Modified on 18 October 2026 to rewrite the target of a symbolic
+ *    link rather than the link, to keep hard links and ownership,
+ *    and to key the cache on modification times in nanoseconds.
  */
 
 #include "stdio.h"
 #include "ctype.h"
 #include <string.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include "tabelib.h"
 
 #define FALSE 0
 #define TRUE  1
-#define TAB_EXPAND 0
-#define TAB_COMPRESS 1
-#define TAB_BOLONLY 2
 
 int chpertab = 4;
+int exptype;
+int colmode = COL_BYTES;
+long long scanstart;        /* when this run started, in ns */
+
+/* A file's modification time in nanoseconds, or as near as the
+ * system records it.
+ */
+#if defined(__APPLE__)
+#define MTIME_NS(st) ((long long)(st)->st_mtimespec.tv_sec * 1000000000 + \
+  (st)->st_mtimespec.tv_nsec)
+#elif defined(_WIN32)
+#define MTIME_NS(st) ((long long)(st)->st_mtime * 1000000000)
+#else
+#define MTIME_NS(st) ((long long)(st)->st_mtim.tv_sec * 1000000000 + \
+  (st)->st_mtim.tv_nsec)
+#endif
+
+/* One line of the clean-file cache.  A file is known to be clean
+ * (that is, tabe would not change it) if its path, size and
+ * modification time, and the tab width and mode, all match.
+ */
+typedef struct {
+  char *path;
+  long long size;
+  long long mtime;  /* in nanoseconds */
+  int  tabs;
+  int  mode;
+  int  dead;      /* superseded by a newer entry; don't save */
+  int  used;      /* matched a file this run, so the file exists */
+} CACHEENT;
+
+CACHEENT *cache = NULL;     /* entries loaded from the file, sorted by path */
+int ncache = 0;
+CACHEENT *newcache = NULL;  /* entries added during this run */
+int nnewcache = 0, maxnewcache = 0;
+
+/* Output callback that writes to a file. */
+void fileout(void *ctx, const char *buf, size_t len)
+{
+  fwrite(buf, 1, len, (FILE *)ctx);
+}
+
+/* Copy a file, expanding or compressing tabs according to exptype.
+ * Entry: in  is the input file.
+ *        out is the output file.
+ */
+void tabfilter(FILE *in, FILE *out)
+{
+  TABESTATE ts;
+  char block[65536];
+  size_t nread;
+
+  tabe_init(&ts, exptype, chpertab, colmode);
+  while((nread = fread(block, 1, sizeof(block), in)) > 0) {
+    tabe_feed(&ts, block, nread, fileout, out);
+  }
+  tabe_finish(&ts, fileout, out);
+}
+
+/* The mode recorded in the cache.  Column counting affects only
+ * the output of -c; the -e and -b scans do not depend on it.
+ */
+int cachemode()
+{
+  if(exptype == TAB_COMPRESS) return exptype + 16*colmode;
+  return exptype;
+}
+
+int cachecmp(const void *a, const void *b)
+{
+  return strcmp(((const CACHEENT *)a)->path, ((const CACHEENT *)b)->path);
+}
+
+/* Read the clean-file cache, if it exists.
+ * Each line is:  size mtime tabs mode path
+ */
+void loadcache(const char *cachefile)
+{
+  FILE *fp;
+  char line[4096];
+  CACHEENT ent;
+  int pathpos, maxcache = 0;
+  size_t plen;
+
+  fp = fopen(cachefile, "r");
+  if(!fp) return;
+  while(fgets(line, sizeof(line), fp)) {
+    plen = strlen(line);
+    if(plen && line[plen-1] == '\n') line[--plen] = '\0';
+    if(sscanf(line, "%lld %lld %d %d %n", &ent.size, &ent.mtime,
+      &ent.tabs, &ent.mode, &pathpos) != 4) continue;
+    if(ncache >= maxcache) {
+      maxcache = maxcache ? 2*maxcache : 256;
+      cache = (CACHEENT *)realloc(cache, maxcache * sizeof(CACHEENT));
+    }
+    ent.path = strdup(line + pathpos);
+    ent.dead = ent.used = FALSE;
+    cache[ncache++] = ent;
+  }
+  fclose(fp);
+  qsort(cache, ncache, sizeof(CACHEENT), cachecmp);
+}
+
+/* Look up a file in the cache.
+ * Exit:  Returns TRUE if the file is known to need no change.
+ *        A stale entry for the same path and settings is marked
+ *          dead, so that it is dropped when the cache is saved.
+ */
+int incache(const char *path, const struct stat *st)
+{
+  CACHEENT key, *ent;
+  int j;
+
+  if(!ncache) return FALSE;
+  key.path = (char *)path;
+  ent = (CACHEENT *)bsearch(&key, cache, ncache, sizeof(CACHEENT), cachecmp);
+  if(!ent) return FALSE;
+  /* Entries for the same path are adjacent; back up to the first. */
+  j = ent - cache;
+  while(j > 0 && strcmp(cache[j-1].path, path) == 0) j--;
+  for(; j < ncache && strcmp(cache[j].path, path) == 0; j++) {
+    ent = &cache[j];
+    if(ent->dead || ent->tabs != chpertab || ent->mode != cachemode()) continue;
+    if(ent->size == (long long)st->st_size &&
+       ent->mtime == MTIME_NS(st)) {
+      ent->used = TRUE;
+      return TRUE;
+    }
+    ent->dead = TRUE;
+  }
+  return FALSE;
+}
+
+/* Remember that a file is clean.
+ * A file modified since this run started is not remembered: it may
+ * be modified again within the same clock tick, changing neither
+ * its size nor its modification time, and the cache would never
+ * notice.
+ */
+void addcache(const char *path, const struct stat *st)
+{
+  CACHEENT *ent;
+
+  if(strchr(path, '\n') || MTIME_NS(st) >= scanstart) return;
+  if(nnewcache >= maxnewcache) {
+    maxnewcache = maxnewcache ? 2*maxnewcache : 256;
+    newcache = (CACHEENT *)realloc(newcache, maxnewcache * sizeof(CACHEENT));
+  }
+  ent = &newcache[nnewcache++];
+  ent->path = strdup(path);
+  ent->size = st->st_size;
+  ent->mtime = MTIME_NS(st);
+  ent->tabs = chpertab;
+  ent->mode = cachemode();
+  ent->dead = ent->used = FALSE;
+}
+
+void writeents(FILE *fp, CACHEENT *ents, int nents)
+{
+  int j;
+
+  for(j=0; j<nents; j++) {
+    if(ents[j].dead) continue;
+    fprintf(fp, "%lld %lld %d %d %s\n", ents[j].size, ents[j].mtime,
+      ents[j].tabs, ents[j].mode, ents[j].path);
+  }
+}
+
+/* Drop cache entries that would only take up room: loaded entries
+ * for files that no longer exist, and repeats among the new entries,
+ * which a file named twice on the command line leaves behind.
+ */
+void prunecache()
+{
+  struct stat st;
+  int j;
+
+  for(j=0; j<ncache; j++) {
+    if(cache[j].dead || cache[j].used) continue;
+    if(stat(cache[j].path, &st) != 0 && errno == ENOENT) cache[j].dead = TRUE;
+  }
+  qsort(newcache, nnewcache, sizeof(CACHEENT), cachecmp);
+  for(j=1; j<nnewcache; j++) {
+    if(strcmp(newcache[j].path, newcache[j-1].path) == 0 &&
+       newcache[j].tabs == newcache[j-1].tabs &&
+       newcache[j].mode == newcache[j-1].mode) newcache[j-1].dead = TRUE;
+  }
+}
+
+/* Write the cache back out, replacing the old file only once
+ * the new one is complete.
+ */
+int savecache(const char *cachefile)
+{
+  FILE *fp;
+  char *tmpname;
+  int err;
+
+  if(!nnewcache) return 0;
+  tmpname = (char *)malloc(strlen(cachefile) + 5);
+  sprintf(tmpname, "%s.tmp", cachefile);
+  fp = fopen(tmpname, "w");
+  if(!fp) {
+    perror(tmpname);
+    free(tmpname);
+    return 1;
+  }
+  prunecache();
+  writeents(fp, cache, ncache);
+  writeents(fp, newcache, nnewcache);
+  err = ferror(fp);
+  if(fclose(fp) || err || rename(tmpname, cachefile)) {
+    perror(cachefile);
+    remove(tmpname);
+    err = 1;
+  }
+  free(tmpname);
+  return err;
+}
+
+/* Read a whole file into memory.
+ * Exit:  Returns a malloc'ed buffer, or NULL if an error occurs.
+ */
+char *loadfile(const char *path, size_t size)
+{
+  FILE *fp;
+  char *buf;
+
+  fp = fopen(path, "rb");
+  if(!fp) {
+    perror(path);
+    return NULL;
+  }
+  buf = (char *)malloc(size ? size : 1);
+  if(buf && fread(buf, 1, size, fp) != size) {
+    fprintf(stderr, "Error reading %s\n", path);
+    free(buf);
+    buf = NULL;
+  }
+  fclose(fp);
+  return buf;
+}
+
+/* Write buf to a file, expanding or compressing tabs.
+ * Exit:  Returns 0 if successful, else nonzero.
+ */
+int writefile(FILE *out, const char *buf, size_t size)
+{
+  TABESTATE ts;
+
+  tabe_init(&ts, exptype, chpertab, colmode);
+  tabe_feed(&ts, buf, size, fileout, out);
+  tabe_finish(&ts, fileout, out);
+  return ferror(out) | fclose(out);
+}
+
+/* Create an empty temporary file beside path, where it can be
+ * renamed over path.  An existing file is never reused.
+ * Exit:  Returns the file open for writing, and its malloc'ed name
+ *          in *tmpname, or NULL if an error occurs.
+ */
+FILE *maketemp(const char *path, char **tmpname)
+{
+  FILE *out = NULL;
+  char *name;
+#ifndef _WIN32
+  int fd;
+#endif
+
+  name = (char *)malloc(strlen(path) + 8);
+  if(!name) return NULL;
+  sprintf(name, "%s.XXXXXX", path);
+#ifdef _WIN32
+  if(_mktemp_s(name, strlen(name) + 1) == 0) out = fopen(name, "wbx");
+#else
+  fd = mkstemp(name);
+  if(fd >= 0 && !(out = fdopen(fd, "wb"))) {
+    close(fd);
+    remove(name);
+  }
+#endif
+  if(!out) {
+    perror(path);
+    free(name);
+    return NULL;
+  }
+  *tmpname = name;
+  return out;
+}
+
+/* Copy a temporary file over the file it was made for, for when it
+ * cannot simply be renamed.  The file is not truncated first, but
+ * overwritten and then cut to length, so that it is left alone if
+ * it cannot be opened.
+ * Exit:  Returns 0 if successful, else nonzero.
+ */
+int copyback(const char *tmpname, const char *path)
+{
+  FILE *in, *out;
+  char buf[65536];
+  size_t n;
+  long long size = 0;
+  int err;
+
+  in = fopen(tmpname, "rb");
+  if(!in) return 1;
+  out = fopen(path, "r+b");
+  if(!out) {
+    fclose(in);
+    return 1;
+  }
+  while((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+    if(fwrite(buf, 1, n, out) != n) break;
+    size += n;
+  }
+  err = ferror(in) || ferror(out) || fflush(out);
+#ifdef _WIN32
+  if(!err) err = _chsize_s(_fileno(out), size) != 0;
+#else
+  if(!err) err = ftruncate(fileno(out), (off_t)size) != 0;
+#endif
+  fclose(in);
+  return fclose(out) | err;
+}
+
+/* Expand or compress tabs in a file in place.
+ * The file is scanned first; if it would not change, it is not
+ * rewritten, so that its modification time is left alone.
+ * A changed file is written to a new temporary file that then
+ * replaces it.  If that would break a hard link or lose the owner,
+ * the temporary file is copied over the file instead, and is kept
+ * if that fails.
+ * Exit:  Returns 0 if successful, else nonzero.
+ */
+int tabpath(const char *path)
+{
+  struct stat st;
+  char *buf, *tmpname;
+  int retval = 0, inplace;
+  FILE *out;
+  TABESTATE ts;
+
+  if(stat(path, &st) != 0) {
+    perror(path);
+    return 1;
+  }
+  if(incache(path, &st)) return 0;
+
+  buf = loadfile(path, (size_t)st.st_size);
+  if(!buf) return 1;
+  tabe_init(&ts, exptype, chpertab, colmode);
+  if(!tabe_wouldchange(&ts, buf, (size_t)st.st_size)) {
+    addcache(path, &st);
+    free(buf);
+    return 0;
+  }
+
+  out = maketemp(path, &tmpname);
+  if(!out) {
+    free(buf);
+    return 1;
+  }
+  if(writefile(out, buf, (size_t)st.st_size)) {
+    perror(tmpname);
+    remove(tmpname);
+    retval = 1;
+  } else {
+    chmod(tmpname, st.st_mode & 07777);
+    inplace = st.st_nlink > 1;
+#ifndef _WIN32
+    if(!inplace && chown(tmpname, st.st_uid, st.st_gid) != 0) inplace = TRUE;
+#endif
+    if(inplace) {
+      if(copyback(tmpname, path) != 0) {
+        fprintf(stderr, "Error rewriting %s; the new version is in %s\n",
+          path, tmpname);
+        retval = 1;
+      } else {
+        remove(tmpname);
+      }
+    } else if(rename(tmpname, path) != 0) {
+      perror(path);
+      remove(tmpname);
+      retval = 1;
+    }
+  }
+  free(tmpname);
+  free(buf);
+  return retval;
+}
+
+/* Expand or compress tabs in a file named on the command line.
+ * A symbolic link is followed, so that the file it points to is
+ * rewritten, and the link is left a link.
+ * Exit:  Returns 0 if successful, else nonzero.
+ */
+int tabfile(const char *path)
+{
+#ifndef _WIN32
+  struct stat st;
+  char *real;
+  int retval;
+
+  if(lstat(path, &st) == 0 && S_ISLNK(st.st_mode)) {
+    real = realpath(path, NULL);
+    if(!real) {
+      perror(path);
+      return 1;
+    }
+    retval = tabpath(real);
+    free(real);
+    return retval;
+  }
+#endif
+  return tabpath(path);
+}
 
 main(argc,argv)
 int argc;
 char *argv[];
 {
-
-  int curcol=0;
-  int nextcol;
-  int ch;
-  int k;
-  int nspaces;
   int gottype = FALSE;
-  int exptype;
   int whicharg;
   int ccerror = FALSE;
+  char *cachefile = NULL;
+  int nfiles = 0;
+  int retval = 0;
 
   for(whicharg=1; whicharg<argc; whicharg++) {
     if(strcmp(argv[whicharg],"-c") == 0) {
@@ -51,15 +482,25 @@ char *argv[];
     } else if(strcmp(argv[whicharg],"-b") == 0) {
       exptype = TAB_BOLONLY;
       gottype = TRUE;
+    } else if(strcmp(argv[whicharg],"-u") == 0) {
+      colmode = COL_UTF8;
+    } else if(strcmp(argv[whicharg],"-w") == 0) {
+      colmode = COL_WIDE;
+    } else if(strcmp(argv[whicharg],"-k") == 0 && whicharg+1 < argc) {
+      cachefile = argv[++whicharg];
     } else if((*(argv[whicharg]) == '-') && isdigit(*(argv[whicharg]+1))) {
       chpertab = atoi(argv[whicharg]+1);
+    } else if(*(argv[whicharg]) != '-') {
+      /* File names are processed once all options are known. */
+      argv[1+nfiles++] = argv[whicharg];
     } else {
       ccerror = TRUE;
     }
   } /* end for whicharg */
 
-  if(ccerror | !gottype) {
-    fputs("Usage:  tabe {-e | -c | -b} [-tabcount]\n",stderr);
+  if(ccerror | !gottype | (chpertab < 1)) {
+    fputs("Usage:  tabe {-e | -c | -b} [-tabcount] [-u | -w] [-k cachefile] [file ...]\n",
+      stderr);
     fputs(" where:\n",stderr);
     fputs("  -e means expand tabs to spaces\n",stderr);
     fputs("  -c means compress multiple spaces to tabs\n",stderr);
@@ -70,107 +511,28 @@ char *argv[];
       stderr);
     fputs("             are between consecutive tabs; default is 4.\n",
       stderr);
-    goto endit;
-  }
-
-  if(exptype == TAB_EXPAND) {
-    while((ch = getchar()) != EOF) {
-      if(ch == '\t') {
-        nextcol = ((curcol/chpertab)+1) * chpertab;
-        nspaces = nextcol - curcol;
-        for(k=0; k<nspaces; k++) {
-          putchar(' ');
-          curcol++;
-        }
-      } else if(ch == '\n') {
-        curcol = 0;
-        putchar(ch);
-      } else {
-        putchar(ch);
-        curcol++;
-      }
-    } /* end while getchar */
-
-  } else if(exptype == TAB_COMPRESS) {
-    /*  We must compress blanks into tabs. */
-
-    char  line[256];
-    int   nwhite;
-    int   lastnonblank;
-    char  *chptr = line;
-    int   jpos;
-    int   nchars;
-    int   k;
-
-    chptr = line;
-    while((ch = getchar()) != EOF) {
-      if(ch != '\n') {
-        *(chptr++) = ch;
-      } else {
-        nchars = chptr - line;
-        chptr = line;
-        nwhite = 0;
-        lastnonblank = -1;
-
-        for(jpos=0; jpos<nchars; jpos++) {
-          if(line[jpos] != ' ') {
-            if(lastnonblank == jpos-1) {
-             /* putchar(line[jpos]); */
-            } else {
-              nwhite = jpos - lastnonblank - 1;
-              if(nwhite < 2) {
-                for(k=0; k<nwhite; k++) putchar(' ');
-              } else {
-                for(k=0; k<(jpos/chpertab - lastnonblank/chpertab); k++) {
-                  putchar('\t');
-                }
-                for(k=0; k<(jpos%chpertab); k++) putchar(' ');
-              }
-            } /* end of else re. lastnonblank */
-            putchar(line[jpos]);
-            lastnonblank = jpos;
-          } /* end of if line[jpos] */
-        } /* end of for jpos */
-        putchar('\n');
-      } /* end of else ch */
-    } /* end of while getchar */
-  /* end of compression */
-  } else {
+    fputs("  -u means count columns in UTF-8 characters, not bytes\n",stderr);
+    fputs("  -w is like -u, but East Asian wide characters count two\n",
+      stderr);
+    fputs("  -k names a cache of files already known to need no change\n",
+      stderr);
+    fputs("  Files named are rewritten in place, but only if they change.\n",
+      stderr);
+    fputs("  With no files, tabe copies standard input to standard output.\n",
+      stderr);
+    return 2;
+  }
 
-    /* We must compress spaces at beginning of line */
-
-    int nchars=0;
-    int gotnonblank = FALSE;
-    int ntabs, nspaces;
-    int k;
-
-    while((ch = getchar()) != EOF) {
-      if(ch == '\n') {
-        putchar('\n');
-        nchars = 0;
-        gotnonblank = FALSE;
-      } else if(gotnonblank) {
-       /*
-        * If we've already processed the first non-blank on a line,
-        * just copy all the remaining characters.
-        */
-        putchar(ch);
-      } else if(ch == ' ') {
-        /* Leading blanks in a line. */
-        nchars++;
-      } else if(ch == '\t') {
-        /* Leading tab in a line--just copy it over. */
-        putchar(ch);
-      } else {
-        /* This is the first non-blank in a line. */
-        gotnonblank = TRUE;
-        ntabs = nchars / chpertab;
-        nspaces = nchars % chpertab;
-        for (k=0; k<ntabs;   k++) putchar('\t');
-        for (k=0; k<nspaces; k++) putchar(' ');
-        putchar(ch);
-      } /* end of if ch ... */
-    } /* end of while getchar ... */
-  } /* end of if gettype ... */
-endit:;
+  if(!nfiles) {
+    tabfilter(stdin, stdout);
+    return 0;
+  }
+
+  scanstart = (long long)time(NULL) * 1000000000;
+  if(cachefile) loadcache(cachefile);
+  for(whicharg=1; whicharg<=nfiles; whicharg++) {
+    if(tabfile(argv[whicharg])) retval = 1;
+  }
+  if(cachefile && savecache(cachefile)) retval = 1;
+  return retval;
 }
@@ -0,0 +1,563 @@
+/*  TABEBENCH.C -- Throughput benchmark and property checks for tabe.
+ *  Build with:
+ *    cc -O2 -o tabebench tabebench.c tabelib.c
+ *
+ *  tabebench generates test corpora in memory (empty, tab-dense,
+ *  long lines, CRLF, mixed indentation, and non-ASCII text), then:
+ *
+ *  1. Checks properties that every version of tabe should have:
+ *     - expanding after -b gives the same text as expanding directly
+ *       (ignoring white space at the end of a line, which -b drops
+ *       on lines that have nothing else);
+ *     - -e and -b give the same result when run twice as once;
+ *     - output does not depend on how the input is split into pieces;
+ *     - tabe_wouldchange agrees with the actual output.
+ *  2. Measures throughput in MB/s for -e, -c and -b at several tab
+ *     widths, in a child process.  The memory used is measured by
+ *     running the real tabe program (-t, default ./tabe) on a copy of
+ *     each corpus written to a file, as tabe is used on a tree.  It is
+ *     reported as the growth in peak resident memory over running tabe
+ *     on an empty file, so that neither this program nor the start-up
+ *     cost of tabe is counted.
+ *
+ *  Results can be saved with -o and compared against a saved
+ *  baseline with -r; slowdowns of more than 10% are flagged.
+ *
+ *  Written 18 October 2026.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "tabelib.h"
+
+#define FALSE 0
+#define TRUE  1
+
+#define CORP_EMPTY 0
+#define CORP_TABDENSE 1
+#define CORP_LONGLINE 2
+#define CORP_CRLF 3
+#define CORP_MIXED 4
+#define CORP_NONASCII 5
+#define NCORPORA 6
+
+const char *corpnames[NCORPORA] = {
+  "empty", "tabdense", "longline", "crlf", "mixedindent", "nonascii"
+};
+const char *modenames[] = { "-e", "-c", "-b" };
+const char *colnames[] = { "bytes", "utf8", "wide" };
+int tabwidths[] = { 2, 4, 8 };
+#define NTABWIDTHS ((int)(sizeof(tabwidths)/sizeof(tabwidths[0])))
+
+/* A fixed-seed generator, so every run builds the same corpus. */
+unsigned long seed = 1;
+unsigned long rnd(unsigned long n)
+{
+  seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (unsigned long)((seed >> 33) % n);
+}
+
+/* A growable buffer. */
+typedef struct {
+  char   *buf;
+  size_t len;
+  size_t max;
+} BUF;
+
+void bufadd(BUF *b, const char *s, size_t n)
+{
+  if(b->len + n > b->max) {
+    b->max = 2*(b->len + n) + 1024;
+    b->buf = (char *)realloc(b->buf, b->max);
+    if(!b->buf) {
+      fputs("Out of memory\n", stderr);
+      exit(2);
+    }
+  }
+  memcpy(b->buf + b->len, s, n);
+  b->len += n;
+}
+
+void bufputs(BUF *b, const char *s)
+{
+  bufadd(b, s, strlen(s));
+}
+
+/* Output callback that appends to a BUF. */
+void bufout(void *ctx, const char *buf, size_t len)
+{
+  bufadd((BUF *)ctx, buf, len);
+}
+
+/* Output callback that only counts, for timing. */
+void countout(void *ctx, const char *buf, size_t len)
+{
+  (void)buf;
+  *(size_t *)ctx += len;
+}
+
+/* Generate a corpus of about size bytes. */
+void gencorpus(int kind, size_t size, BUF *b)
+{
+  static const char *words[] = {
+    "int", "x", "return", "if(k<n)", "{", "}", "/* note */", "foo(bar);",
+    "ch", "=", "0;"
+  };
+  static const char *uwords[] = {
+    "caf\xc3\xa9", "na\xc3\xafve", "\xe6\xbc\xa2\xe5\xad\x97",
+    "\xe3\x81\x8b\xe3\x81\xaa", "\xf0\x9f\x98\x80", "r\xc3\xa9sum\xc3\xa9",
+    "plain", "\xd0\xbc\xd0\xb8\xd1\x80"
+  };
+  static const char *indents[] = {
+    "", "\t", "\t\t", "    ", "        ", "  \t", "\t  ", "   \t ",
+    " \t\t   ", "      "
+  };
+  int k, nwords;
+
+  b->len = 0;
+  seed = 12345 + kind;
+  if(kind == CORP_EMPTY) return;
+  while(b->len < size) {
+    switch(kind) {
+    case CORP_TABDENSE:
+      for(k=(int)rnd(4); k>0; k--) bufputs(b, "\t");
+      nwords = 1 + (int)rnd(8);
+      for(k=0; k<nwords; k++) {
+        bufputs(b, words[rnd(11)]);
+        bufputs(b, rnd(3) ? "\t" : "\t\t");
+      }
+      bufputs(b, "\n");
+      break;
+    case CORP_LONGLINE:
+      for(k=0; k<4000; k++) {
+        bufputs(b, words[rnd(11)]);
+        bufputs(b, rnd(10) ? " " : rnd(2) ? "\t" : "     ");
+      }
+      bufputs(b, "\n");
+      break;
+    case CORP_CRLF:
+      for(k=(int)rnd(4); k>0; k--) bufputs(b, "    ");
+      nwords = (int)rnd(8);
+      for(k=0; k<nwords; k++) {
+        bufputs(b, words[rnd(11)]);
+        bufputs(b, rnd(4) ? " " : "\t");
+      }
+      bufputs(b, "\r\n");
+      break;
+    case CORP_MIXED:
+      bufputs(b, indents[rnd(10)]);
+      nwords = (int)rnd(6);
+      for(k=0; k<nwords; k++) {
+        bufputs(b, words[rnd(11)]);
+        bufputs(b, rnd(5) ? " " : rnd(2) ? "\t" : "   ");
+      }
+      bufputs(b, "\n");
+      break;
+    case CORP_NONASCII:
+      bufputs(b, indents[rnd(10)]);
+      nwords = 1 + (int)rnd(8);
+      for(k=0; k<nwords; k++) {
+        bufputs(b, uwords[rnd(8)]);
+        bufputs(b, rnd(3) ? " " : "\t");
+      }
+      bufputs(b, "// ");
+      bufputs(b, uwords[rnd(8)]);
+      bufputs(b, "\n");
+      break;
+    }
+  }
+}
+
+/* Transform a whole buffer into out.
+ * Entry: chunk is the size of the pieces to feed, or 0 for random
+ *          sizes from 1 to 64.
+ */
+void transform(int mode, int tabs, int colmode, const char *in, size_t len,
+  size_t chunk, BUF *out)
+{
+  TABESTATE ts;
+  size_t pos, n;
+
+  out->len = 0;
+  tabe_init(&ts, mode, tabs, colmode);
+  for(pos=0; pos<len; pos+=n) {
+    n = chunk ? chunk : 1 + rnd(64);
+    if(n > len - pos) n = len - pos;
+    tabe_feed(&ts, in + pos, n, bufout, out);
+  }
+  tabe_finish(&ts, bufout, out);
+}
+
+/* Remove white space at the end of each line. */
+void rstriplines(BUF *b)
+{
+  size_t j, k = 0, keep = 0;   /* keep is the length up to the last non-blank */
+  char ch;
+
+  for(j=0; j<b->len; j++) {
+    ch = b->buf[j];
+    if(ch == '\n') {
+      k = keep;
+      b->buf[k++] = ch;
+      keep = k;
+    } else {
+      b->buf[k++] = ch;
+      if(ch != ' ' && ch != '\t' && ch != '\r') keep = k;
+    }
+  }
+  b->len = keep;
+}
+
+int sameb(const BUF *a, const BUF *b)
+{
+  return a->len == b->len && (!a->len || memcmp(a->buf, b->buf, a->len) == 0);
+}
+
+int nfailed = 0;
+
+void fail(const char *what, int kind, int mode, int tabs, int colmode)
+{
+  printf("FAIL  %-34s %-12s %s -%d %s\n", what, corpnames[kind],
+    modenames[mode], tabs, colnames[colmode]);
+  nfailed++;
+}
+
+/* Check the properties on every corpus. */
+int checkprops(size_t size)
+{
+  BUF in = {0}, a = {0}, b = {0}, c = {0};
+  int kind, mode, t, tabs, colmode, changed;
+  int nchecks = 0;
+
+  for(kind=0; kind<NCORPORA; kind++) {
+    gencorpus(kind, size, &in);
+    for(t=0; t<NTABWIDTHS; t++) {
+      tabs = tabwidths[t];
+      for(colmode=COL_BYTES; colmode<=COL_WIDE; colmode++) {
+        /* Expanding after -b is the same as expanding directly. */
+        transform(TAB_EXPAND, tabs, colmode, in.buf, in.len, in.len, &a);
+        transform(TAB_BOLONLY, tabs, colmode, in.buf, in.len, in.len, &b);
+        transform(TAB_EXPAND, tabs, colmode, b.buf, b.len, b.len, &c);
+        rstriplines(&a);
+        rstriplines(&c);
+        nchecks++;
+        if(!sameb(&a, &c)) {
+          fail("expand(bol(x)) == expand(x)", kind, TAB_BOLONLY, tabs, colmode);
+        }
+
+        for(mode=TAB_EXPAND; mode<=TAB_BOLONLY; mode++) {
+          TABESTATE ts;
+
+          transform(mode, tabs, colmode, in.buf, in.len, in.len, &a);
+
+          /* Splitting the input makes no difference. */
+          transform(mode, tabs, colmode, in.buf, in.len, 0, &b);
+          nchecks++;
+          if(!sameb(&a, &b)) {
+            fail("random chunks == one chunk", kind, mode, tabs, colmode);
+          }
+          transform(mode, tabs, colmode, in.buf, in.len, 1, &b);
+          nchecks++;
+          if(!sameb(&a, &b)) {
+            fail("1-byte chunks == one chunk", kind, mode, tabs, colmode);
+          }
+
+          /* tabe_wouldchange predicts whether the output differs. */
+          tabe_init(&ts, mode, tabs, colmode);
+          changed = !sameb(&a, &in);
+          nchecks++;
+          if(tabe_wouldchange(&ts, in.buf, in.len) != changed) {
+            fail("wouldchange == (output != input)", kind, mode, tabs, colmode);
+          }
+
+          /* -e and -b are idempotent. */
+          if(mode != TAB_COMPRESS) {
+            transform(mode, tabs, colmode, a.buf, a.len, a.len, &b);
+            nchecks++;
+            if(!sameb(&a, &b)) fail("f(f(x)) == f(x)", kind, mode, tabs, colmode);
+            tabe_init(&ts, mode, tabs, colmode);
+            nchecks++;
+            if(tabe_wouldchange(&ts, a.buf, a.len)) {
+              fail("!wouldchange(f(x))", kind, mode, tabs, colmode);
+            }
+          }
+        }
+      }
+    }
+  }
+  printf("%d property checks, %d failed\n", nchecks, nfailed);
+  free(in.buf);
+  free(a.buf);
+  free(b.buf);
+  free(c.buf);
+  return nfailed;
+}
+
+double now()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* One benchmark result. */
+typedef struct {
+  char   key[64];   /* corpus, mode, tab width and column mode */
+  double mbps;
+  long   rsskb;     /* growth in tabe's peak memory, in KB */
+} RESULT;
+
+char *tabepath = "./tabe";
+#define SRCFILE "tabebench.src"
+#define RUNFILE "tabebench.tmp"
+
+/* Copy a file with a small buffer, so that this process stays small.
+ * Exit:  Returns 0 if successful.
+ */
+int copyfile(const char *from, const char *to)
+{
+  char buf[65536];
+  int in, out, err = 0;
+  ssize_t n;
+
+  in = open(from, O_RDONLY);
+  out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  while(in >= 0 && out >= 0 && (n = read(in, buf, sizeof(buf))) > 0) {
+    if(write(out, buf, n) != n) err = 1;
+  }
+  if(in < 0 || out < 0) err = 1;
+  if(in >= 0) close(in);
+  if(out >= 0 && close(out) != 0) err = 1;
+  return err;
+}
+
+/* Run tabe on a copy of a file, as it is run on a tree.
+ * Exit:  Returns tabe's peak resident memory in KB, or -1 if it
+ *          could not be run or failed.
+ */
+long runtabe(const char *path, int mode, int tabs, int colmode)
+{
+  static const char *colflags[] = { NULL, "-u", "-w" };
+  char tabflag[16];
+  int status;
+  pid_t pid;
+  struct rusage ru;
+  long kb;
+
+  if(copyfile(path, RUNFILE) != 0) return -1;
+  sprintf(tabflag, "-%d", tabs);
+  pid = fork();
+  if(pid < 0) return -1;
+  if(pid == 0) {
+    execl(tabepath, tabepath, modenames[mode], tabflag, RUNFILE,
+      colflags[colmode], (char *)NULL);
+    _exit(127);
+  }
+  if(wait4(pid, &status, 0, &ru) < 0) return -1;
+  remove(RUNFILE);
+  if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+  kb = ru.ru_maxrss;
+#ifdef __APPLE__
+  kb /= 1024;   /* macOS reports bytes, not kilobytes */
+#endif
+  return kb;
+}
+
+/* Time one transform in a child process, which also writes the corpus
+ * to SRCFILE for runtabe.
+ * Exit:  Fills in r.mbps.  Returns 0 if successful.
+ */
+int bench1(int kind, int mode, int tabs, int colmode, size_t size, int reps,
+  RESULT *r)
+{
+  int fds[2], status, rep;
+  pid_t pid;
+  double best = 0.0, t0, secs, mbps;
+  BUF in = {0};
+  TABESTATE ts;
+  size_t count, pos, n;
+  FILE *fp;
+
+  sprintf(r->key, "%s %s -%d %s", corpnames[kind], modenames[mode], tabs,
+    colnames[colmode]);
+  r->mbps = 0.0;
+  r->rsskb = 0;
+  if(pipe(fds) != 0) return 1;
+  pid = fork();
+  if(pid < 0) return 1;
+  if(pid == 0) {
+    close(fds[0]);
+    gencorpus(kind, size, &in);
+    fp = fopen(SRCFILE, "wb");
+    if(!fp || fwrite(in.buf, 1, in.len, fp) != in.len || fclose(fp) != 0) {
+      _exit(1);
+    }
+    for(rep=0; rep<reps && in.len; rep++) {
+      count = 0;
+      t0 = now();
+      tabe_init(&ts, mode, tabs, colmode);
+      for(pos=0; pos<in.len; pos+=n) {
+        n = in.len - pos < 65536 ? in.len - pos : 65536;
+        tabe_feed(&ts, in.buf + pos, n, countout, &count);
+      }
+      tabe_finish(&ts, countout, &count);
+      secs = now() - t0;
+      mbps = secs > 0 ? in.len / secs / 1e6 : 0.0;
+      if(mbps > best) best = mbps;
+    }
+    if(write(fds[1], &best, sizeof(best)) != sizeof(best)) _exit(1);
+    _exit(0);
+  }
+  close(fds[1]);
+  if(read(fds[0], &r->mbps, sizeof(r->mbps)) != sizeof(r->mbps)) r->mbps = -1;
+  close(fds[0]);
+  if(waitpid(pid, &status, 0) < 0) return 1;
+  return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+/* Read a results file written with -o.
+ * Exit:  Returns the number of results read into *res.
+ */
+int loadresults(const char *path, RESULT **res)
+{
+  FILE *fp;
+  char line[256], c[32], m[8], t[8], cm[8];
+  int n = 0, max = 0;
+  RESULT r;
+
+  *res = NULL;
+  fp = fopen(path, "r");
+  if(!fp) {
+    perror(path);
+    return 0;
+  }
+  while(fgets(line, sizeof(line), fp)) {
+    if(sscanf(line, "%31s %7s %7s %7s %lf %ld", c, m, t, cm, &r.mbps,
+      &r.rsskb) != 6) continue;
+    sprintf(r.key, "%s %s %s %s", c, m, t, cm);
+    if(n >= max) {
+      max = max ? 2*max : 64;
+      *res = (RESULT *)realloc(*res, max * sizeof(RESULT));
+    }
+    (*res)[n++] = r;
+  }
+  fclose(fp);
+  return n;
+}
+
+void usage()
+{
+  fputs("Usage:  tabebench [-s megabytes] [-n reps] [-o results] [-r baseline]\n",
+    stderr);
+  fputs("                  [-t tabe] [-P] [-B]\n", stderr);
+  fputs(" where:\n", stderr);
+  fputs("  -s is the size of each benchmark corpus; default is 16\n", stderr);
+  fputs("  -n is the number of timed runs; the best is kept; default 3\n",
+    stderr);
+  fputs("  -o saves the results to a file\n", stderr);
+  fputs("  -r compares the results with a file saved by -o\n", stderr);
+  fputs("  -t is the tabe program whose memory is measured; default ./tabe\n",
+    stderr);
+  fputs("  -P skips the property checks\n", stderr);
+  fputs("  -B skips the benchmarks\n", stderr);
+  exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+  int j, kind, mode, t, colmode, nbase = 0, k;
+  long basekb, kb;
+  int doprops = TRUE, dobench = TRUE, reps = 3, retval = 0;
+  double mb = 16.0, change;
+  char *outpath = NULL, *basepath = NULL;
+  FILE *outfp = NULL;
+  RESULT r, *base = NULL;
+
+  for(j=1; j<argc; j++) {
+    if(strcmp(argv[j], "-s") == 0 && j+1 < argc) {
+      mb = atof(argv[++j]);
+    } else if(strcmp(argv[j], "-n") == 0 && j+1 < argc) {
+      reps = atoi(argv[++j]);
+    } else if(strcmp(argv[j], "-o") == 0 && j+1 < argc) {
+      outpath = argv[++j];
+    } else if(strcmp(argv[j], "-r") == 0 && j+1 < argc) {
+      basepath = argv[++j];
+    } else if(strcmp(argv[j], "-t") == 0 && j+1 < argc) {
+      tabepath = argv[++j];
+    } else if(strcmp(argv[j], "-P") == 0) {
+      doprops = FALSE;
+    } else if(strcmp(argv[j], "-B") == 0) {
+      dobench = FALSE;
+    } else {
+      usage();
+    }
+  }
+  if(mb <= 0 || reps < 1) usage();
+
+  if(doprops && checkprops(256*1024)) retval = 1;
+  if(!dobench) return retval;
+
+  if(basepath) nbase = loadresults(basepath, &base);
+  if(outpath) {
+    outfp = fopen(outpath, "w");
+    if(!outfp) {
+      perror(outpath);
+      return 2;
+    }
+  }
+  /* tabe's memory on an empty file is the zero for the others. */
+  fclose(fopen(SRCFILE, "wb"));
+  basekb = runtabe(SRCFILE, TAB_EXPAND, 4, COL_BYTES);
+  if(basekb < 0) {
+    fprintf(stderr, "Cannot run %s; memory will not be measured\n", tabepath);
+  }
+  printf("%-30s %10s %10s %s\n", "corpus mode tabs columns", "MB/s",
+    "+peak KB", basepath ? "vs. baseline" : "");
+  for(kind=0; kind<NCORPORA; kind++) {
+    for(mode=TAB_EXPAND; mode<=TAB_BOLONLY; mode++) {
+      for(t=0; t<NTABWIDTHS; t++) {
+        for(colmode=COL_BYTES; colmode<=COL_WIDE; colmode++) {
+          /* Column counting matters only for non-ASCII text. */
+          if(colmode != COL_BYTES && kind != CORP_NONASCII) continue;
+          if(bench1(kind, mode, tabwidths[t], colmode, (size_t)(mb*1e6), reps,
+            &r)) {
+            fprintf(stderr, "Benchmark %s failed\n", r.key);
+            retval = 1;
+            continue;
+          }
+          if(basekb >= 0) {
+            kb = runtabe(SRCFILE, mode, tabwidths[t], colmode);
+            if(kb < 0) {
+              fprintf(stderr, "%s failed on %s\n", tabepath, r.key);
+              retval = 1;
+            }
+            r.rsskb = kb > basekb ? kb - basekb : 0;
+          }
+          printf("%-30s %10.1f %10ld", r.key, r.mbps, r.rsskb);
+          for(k=0; k<nbase; k++) {
+            if(strcmp(base[k].key, r.key) != 0) continue;
+            if(base[k].mbps > 0) {
+              change = 100.0 * (r.mbps - base[k].mbps) / base[k].mbps;
+              printf("  %+6.1f%%%s", change, change < -10.0 ? "  SLOWER" : "");
+            }
+            break;
+          }
+          printf("\n");
+          if(outfp) fprintf(outfp, "%s %.1f %ld\n", r.key, r.mbps, r.rsskb);
+        }
+      }
+    }
+  }
+  if(outfp) fclose(outfp);
+  remove(SRCFILE);
+  return retval;
+}
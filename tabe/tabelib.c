@@ -0,0 +1,370 @@
+/*  TABELIB.C -- Streaming tab expansion and compression.
+ *  See tabelib.h for how to use these routines.  The algorithms
+ *  are those of tabe; the only difference is that they keep
+ *  their state in a TABESTATE rather than in local variables, so
+ *  that input can arrive in pieces.
+ */
+
+#include <string.h>
+#include "tabelib.h"
+
+#define FALSE 0
+#define TRUE  1
+
+static const char spaces[] = "                                ";
+static const char tabs[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+#define HASZERO(w) (((w) - ONES) & ~(w) & HIGHS)
+
+/* Write n copies of a character.
+ * Entry: fill is spaces or tabs.
+ */
+static void putrun(const char *fill, int n, TABEOUTFN out, void *ctx)
+{
+  int k;
+
+  while(n > 0) {
+    k = n < (int)(sizeof(spaces)-1) ? n : (int)(sizeof(spaces)-1);
+    out(ctx, fill, k);
+    n -= k;
+  }
+}
+
+/* Decide whether a Unicode character is displayed two columns wide.
+ * These are the East Asian Wide and Fullwidth ranges, plus the
+ * common emoji blocks.
+ */
+static int iswide(long c)
+{
+  static const long wide[][2] = {
+    { 0x1100,  0x115F  }, { 0x2E80,  0x303E  }, { 0x3041,  0x33FF  },
+    { 0x3400,  0x4DBF  }, { 0x4E00,  0x9FFF  }, { 0xA000,  0xA4CF  },
+    { 0xAC00,  0xD7A3  }, { 0xF900,  0xFAFF  }, { 0xFE30,  0xFE4F  },
+    { 0xFF00,  0xFF60  }, { 0xFFE0,  0xFFE6  }, { 0x1F300, 0x1F64F },
+    { 0x1F900, 0x1F9FF }, { 0x20000, 0x2FFFD }, { 0x30000, 0x3FFFD }
+  };
+  int j;
+
+  if(c < wide[0][0]) return FALSE;
+  for(j=0; j<(int)(sizeof(wide)/sizeof(wide[0])); j++) {
+    if(c < wide[j][0]) return FALSE;
+    if(c <= wide[j][1]) return TRUE;
+  }
+  return FALSE;
+}
+
+/* Return the number of display columns to add for a byte of
+ * UTF-8 text.  A character counts one column on its lead byte;
+ * in COL_WIDE mode a wide character counts one more column once
+ * its last byte is seen.  Bytes that are not valid UTF-8 count
+ * one column each, as in byte mode.
+ */
+static int utf8cols(TABESTATE *ts, int ch)
+{
+  if(ch < 0x80) {
+    ts->ucsneed = 0;
+    return 1;
+  } else if(ch < 0xC0) {
+    /* Continuation byte. */
+    if(!ts->ucsneed) return 1;
+    ts->ucs = (ts->ucs << 6) | (ch & 0x3F);
+    if(--ts->ucsneed == 0 && ts->colmode == COL_WIDE && iswide(ts->ucs)) {
+      return 1;
+    }
+    return 0;
+  }
+  ts->ucsneed = (ch >= 0xF0) ? 3 : (ch >= 0xE0) ? 2 : 1;
+  ts->ucs = ch & (0x3F >> ts->ucsneed);
+  return 1;
+}
+
+/* Return the number of display columns taken by n bytes of text
+ * containing no tabs or newlines.  Blocks of eight ASCII bytes
+ * are recognized with one test on a 64-bit word, so that counting
+ * UTF-8 characters costs almost nothing for ASCII text.
+ */
+static int runcols(TABESTATE *ts, const unsigned char *p, size_t n)
+{
+  unsigned long long w;
+  size_t j = 0;
+  int cols = 0;
+
+  if(ts->colmode == COL_BYTES) return (int)n;
+  while(j < n) {
+    if(j+8 <= n && !ts->ucsneed) {
+      memcpy(&w, p+j, 8);
+      if(!(w & HIGHS)) {
+        cols += 8;
+        j += 8;
+        continue;
+      }
+    }
+    cols += utf8cols(ts, p[j++]);
+  }
+  return cols;
+}
+
+/* Return the number of bytes at p before the first occurrence of
+ * either c1 or c2.  Eight bytes are tested at once, using the
+ * usual bit tricks on a 64-bit word, so long runs of ordinary
+ * text cost little.
+ */
+static size_t plainrun(const unsigned char *p, size_t len, int c1, int c2)
+{
+  unsigned long long w;
+  size_t j = 0;
+
+  for(; j+8 <= len; j+=8) {
+    memcpy(&w, p+j, 8);
+    if(HASZERO(w ^ (ONES * c1)) | HASZERO(w ^ (ONES * c2))) break;
+  }
+  for(; j<len; j++) {
+    if(p[j] == c1 || p[j] == c2) break;
+  }
+  return j;
+}
+
+/* Expand tabs to spaces. */
+static void expand(TABESTATE *ts, const unsigned char *p,
+  const unsigned char *end, TABEOUTFN out, void *ctx)
+{
+  size_t run;
+  int nextcol;
+
+  while(p < end) {
+    /* Copy ordinary characters in bulk. */
+    run = plainrun(p, end-p, '\t', '\n');
+    if(run) {
+      out(ctx, (const char *)p, run);
+      ts->curcol += runcols(ts, p, run);
+      p += run;
+      continue;
+    }
+    if(*p == '\t') {
+      nextcol = ((ts->curcol/ts->chpertab)+1) * ts->chpertab;
+      putrun(spaces, nextcol - ts->curcol, out, ctx);
+      ts->curcol = nextcol;
+    } else {
+      out(ctx, "\n", 1);
+      ts->curcol = 0;
+    }
+    ts->ucsneed = 0;
+    p++;
+  }
+}
+
+/* Compress multiple spaces into tabs.  Spaces are held back until
+ * the next non-blank shows where they end; spaces at the end of a
+ * line are dropped.
+ */
+static void compress(TABESTATE *ts, const unsigned char *p,
+  const unsigned char *end, TABEOUTFN out, void *ctx)
+{
+  size_t run;
+  int width, k;
+
+  while(p < end) {
+    if(*p == ' ') {
+      ts->nspaces++;
+      ts->curcol++;
+      ts->ucsneed = 0;
+      p++;
+    } else if(*p == '\n') {
+      out(ctx, "\n", 1);
+      ts->nspaces = 0;
+      ts->curcol = 0;
+      ts->lastcol = -1;
+      ts->ucsneed = 0;
+      p++;
+    } else {
+      if(ts->nspaces < 2) {
+        putrun(spaces, ts->nspaces, out, ctx);
+      } else {
+        k = ts->curcol/ts->chpertab - ts->lastcol/ts->chpertab;
+        putrun(tabs, k, out, ctx);
+        putrun(spaces, ts->curcol % ts->chpertab, out, ctx);
+      }
+      ts->nspaces = 0;
+      run = plainrun(p, end-p, ' ', '\n');
+      out(ctx, (const char *)p, run);
+      width = runcols(ts, p, run);
+      ts->lastcol = ts->curcol + width - 1;
+      ts->curcol += width;
+      p += run;
+    }
+  }
+}
+
+/* Compress spaces to tabs only at the beginning of a line.
+ * The display column reached by the leading blanks and tabs is
+ * counted, and written as tabs and spaces at the first non-blank.
+ * A line with no non-blank keeps its tabs but loses its spaces.
+ */
+static void bolonly(TABESTATE *ts, const unsigned char *p,
+  const unsigned char *end, TABEOUTFN out, void *ctx)
+{
+  const unsigned char *nl;
+
+  while(p < end) {
+    if(ts->gotnonblank) {
+      /* Copy the rest of the line. */
+      nl = (const unsigned char *)memchr(p, '\n', end-p);
+      if(!nl) nl = end;
+      if(nl > p) out(ctx, (const char *)p, nl-p);
+      p = nl;
+      if(p == end) break;
+    }
+    if(*p == '\n') {
+      if(!ts->gotnonblank) putrun(tabs, ts->ntabs, out, ctx);
+      out(ctx, "\n", 1);
+      ts->curcol = 0;
+      ts->ntabs = 0;
+      ts->gotnonblank = FALSE;
+    } else if(*p == ' ') {
+      ts->curcol++;
+    } else if(*p == '\t') {
+      ts->curcol = ((ts->curcol/ts->chpertab)+1) * ts->chpertab;
+      ts->ntabs++;
+    } else {
+      /* This is the first non-blank in a line; it is copied
+       * with the rest of the line. */
+      ts->gotnonblank = TRUE;
+      putrun(tabs, ts->curcol / ts->chpertab, out, ctx);
+      putrun(spaces, ts->curcol % ts->chpertab, out, ctx);
+      continue;
+    }
+    p++;
+  }
+}
+
+/* Set up the state for a new stream.
+ * Entry: mode     is TAB_EXPAND, TAB_COMPRESS or TAB_BOLONLY.
+ *        chpertab is the number of columns between tab stops.
+ *        colmode  is COL_BYTES, COL_UTF8 or COL_WIDE.
+ */
+void tabe_init(TABESTATE *ts, int mode, int chpertab, int colmode)
+{
+  ts->mode = mode;
+  ts->chpertab = chpertab;
+  ts->colmode = colmode;
+  ts->curcol = 0;
+  ts->gotnonblank = FALSE;
+  ts->nspaces = 0;
+  ts->ntabs = 0;
+  ts->lastcol = -1;
+  ts->ucs = 0;
+  ts->ucsneed = 0;
+}
+
+/* Transform the next piece of the input.
+ * Entry: in  points to len bytes of input.  Pieces may be split
+ *              anywhere, even in the middle of a UTF-8 character.
+ *        out is called with each piece of output.
+ */
+void tabe_feed(TABESTATE *ts, const char *in, size_t len,
+  TABEOUTFN out, void *ctx)
+{
+  const unsigned char *p = (const unsigned char *)in;
+
+  if(ts->mode == TAB_EXPAND) {
+    expand(ts, p, p+len, out, ctx);
+  } else if(ts->mode == TAB_COMPRESS) {
+    compress(ts, p, p+len, out, ctx);
+  } else {
+    bolonly(ts, p, p+len, out, ctx);
+  }
+}
+
+/* End the stream.  Spaces still held back are trailing blanks,
+ * so they are dropped; so are the spaces of a last line that has
+ * only white space and no newline, though its tabs are kept.
+ * The state is left ready for a new stream.
+ */
+void tabe_finish(TABESTATE *ts, TABEOUTFN out, void *ctx)
+{
+  if(ts->mode == TAB_BOLONLY && !ts->gotnonblank) {
+    putrun(tabs, ts->ntabs, out, ctx);
+  }
+  tabe_init(ts, ts->mode, ts->chpertab, ts->colmode);
+}
+
+/* Decide whether compressing spaces at beginning of line would
+ * change a buffer.  Only the leading white space of each line is
+ * examined; the rest of the line is skipped with memchr, which
+ * the C library implements with vector instructions.
+ */
+static int bolwouldchange(int chpertab, const char *buf, size_t len)
+{
+  const char *p = buf, *end = buf + len;
+  int nspaces;
+
+  while(p < end) {
+    nspaces = 0;
+    for(; p < end; p++) {
+      if(*p == ' ') {
+        nspaces++;
+      } else if(*p == '\t') {
+        /* Tabs are written before any spaces. */
+        if(nspaces) return TRUE;
+      } else {
+        break;
+      }
+    }
+    if(nspaces >= chpertab) return TRUE;
+    /* Spaces on a line with no non-blank are dropped. */
+    if(nspaces && (p == end || *p == '\n')) return TRUE;
+    p = (const char *)memchr(p, '\n', end - p);
+    if(!p) break;
+    p++;
+  }
+  return FALSE;
+}
+
+typedef struct {
+  const char *p;    /* next byte of the original to compare */
+  size_t left;      /* bytes of the original not yet compared */
+  int differ;
+} CMPCTX;
+
+/* Output callback that compares the output to the original. */
+static void cmpout(void *ctx, const char *buf, size_t len)
+{
+  CMPCTX *cmp = (CMPCTX *)ctx;
+
+  if(cmp->differ) return;
+  if(len > cmp->left || (buf != cmp->p && memcmp(buf, cmp->p, len) != 0)) {
+    cmp->differ = TRUE;
+    return;
+  }
+  cmp->p += len;
+  cmp->left -= len;
+}
+
+/* Decide, without producing any output, whether transforming a
+ * buffer would change it.  -e and -b have quick tests; -c is run
+ * with its output compared to the input as it is produced.
+ * Entry: ts gives the settings to use; it is not modified.
+ * Exit:  Returns TRUE if the output would differ from buf.
+ *        An empty buffer never changes, and buf may then be NULL.
+ */
+int tabe_wouldchange(const TABESTATE *ts, const char *buf, size_t len)
+{
+  TABESTATE dry;
+  CMPCTX cmp;
+
+  if(len == 0) return FALSE;
+  if(ts->mode == TAB_EXPAND) {
+    return memchr(buf, '\t', len) != NULL;
+  } else if(ts->mode == TAB_BOLONLY) {
+    return bolwouldchange(ts->chpertab, buf, len);
+  }
+  tabe_init(&dry, ts->mode, ts->chpertab, ts->colmode);
+  cmp.p = buf;
+  cmp.left = len;
+  cmp.differ = FALSE;
+  tabe_feed(&dry, buf, len, cmpout, &cmp);
+  tabe_finish(&dry, cmpout, &cmp);
+  return cmp.differ || cmp.left != 0;
+}
@@ -0,0 +1,52 @@
+/*  TABELIB.H -- Streaming tab expansion and compression.
+ *  These are the algorithms of the tabe program, packaged so that
+ *  other programs can transform buffers without running tabe.
+ *
+ *  Input is pushed in chunks of any size with tabe_feed, followed
+ *  by one call to tabe_finish.  Output is delivered through a
+ *  callback; ordinary text is passed straight from the caller's
+ *  input buffer, and the library never allocates memory.
+ *
+ *  Example:
+ *    TABESTATE ts;
+ *    tabe_init(&ts, TAB_EXPAND, 4, COL_BYTES);
+ *    tabe_feed(&ts, buf, len, myout, myctx);   (as often as needed)
+ *    tabe_finish(&ts, myout, myctx);
+ */
+
+#ifndef TABELIB_H
+#define TABELIB_H
+
+#include <stddef.h>
+
+#define TAB_EXPAND 0
+#define TAB_COMPRESS 1
+#define TAB_BOLONLY 2
+
+#define COL_BYTES 0   /* every byte is one column */
+#define COL_UTF8 1    /* every UTF-8 character is one column */
+#define COL_WIDE 2    /* as COL_UTF8, but East Asian wide characters are two */
+
+/* Output callback.  buf is valid only for the duration of the call. */
+typedef void (*TABEOUTFN)(void *ctx, const char *buf, size_t len);
+
+typedef struct {
+  int  mode;         /* TAB_EXPAND, TAB_COMPRESS or TAB_BOLONLY */
+  int  chpertab;     /* columns between consecutive tab stops */
+  int  colmode;      /* COL_BYTES, COL_UTF8 or COL_WIDE */
+  int  curcol;       /* display column of the next input character */
+  int  gotnonblank;  /* a non-blank has been seen on this line */
+  int  nspaces;      /* -c: spaces read but not yet written */
+  int  ntabs;        /* -b: leading tabs read but not yet written */
+  int  lastcol;      /* -c: last column of the last non-blank, or -1 */
+  long ucs;          /* UTF-8 character being decoded */
+  int  ucsneed;      /* continuation bytes still expected */
+} TABESTATE;
+
+void tabe_init(TABESTATE *ts, int mode, int chpertab, int colmode);
+void tabe_feed(TABESTATE *ts, const char *in, size_t len,
+  TABEOUTFN out, void *ctx);
+void tabe_finish(TABESTATE *ts, TABEOUTFN out, void *ctx);
+int  tabe_wouldchange(const TABESTATE *ts, const char *buf, size_t len);
+
+#endif